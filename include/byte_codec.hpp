@@ -0,0 +1,109 @@
+#ifndef BYTE_CODEC_HPP
+#define BYTE_CODEC_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Little endian fixed width and LEB128 varint encoding for on-disk records
+
+static inline void PutFixed32(std::string& out, uint32_t v) {
+    char b[4] = {
+        (char)(v & 0xFF), (char)((v >> 8) & 0xFF), (char)((v >> 16) & 0xFF), (char)(v >> 24)
+    };
+    out.append(b, 4);
+}
+
+static inline uint32_t GetFixed32(const char* p) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static inline void PutFixed64(std::string& out, uint64_t v) {
+    PutFixed32(out, (uint32_t)v);
+    PutFixed32(out, (uint32_t)(v >> 32));
+}
+
+static inline uint64_t GetFixed64(const char* p) {
+    return (uint64_t)GetFixed32(p) | ((uint64_t)GetFixed32(p + 4) << 32);
+}
+
+static inline void PutVarint(std::string& out, uint64_t v) {
+    char b[10];
+    int n = 0;
+    while (v >= 0x80) {
+        b[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    b[n++] = (char)v;
+    out.append(b, n);
+}
+
+// Advance p past one varint, false if truncated or overlong
+static inline bool GetVarint(const char*& p, const char* end, uint64_t* v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char byte = (unsigned char)*p++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Length-prefixed bytes
+static inline void PutBytes(std::string& out, const std::string& s) {
+    PutVarint(out, s.size());
+    out.append(s);
+}
+
+static inline bool GetBytes(const char*& p, const char* end, std::string* s) {
+    uint64_t len = 0;
+    if (!GetVarint(p, end, &len) || len > (uint64_t)(end - p)) {
+        return false;
+    }
+    s->assign(p, len);
+    p += len;
+    return true;
+}
+
+// CRC-32 (IEEE), continue crc over more data, start from 0. Slicing-by-8,
+// eight table lookups per 8 bytes instead of one per byte.
+static inline uint32_t Crc32Update(uint32_t crc, const char* data, size_t len) {
+    static uint32_t table[8][256] = {{0}};
+    if (!table[0][1]) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int t = 1; t < 8; ++t) {
+                table[t][i] = table[0][table[t - 1][i] & 0xFF] ^ (table[t - 1][i] >> 8);
+            }
+        }
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    crc ^= 0xFFFFFFFFu;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8)
+                             | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF]
+            ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24]
+            ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+    for (; len; --len) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static inline uint32_t Crc32(const char* data, size_t len) {
+    return Crc32Update(0, data, len);
+}
+
+#endif // BYTE_CODEC_HPP
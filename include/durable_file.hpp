@@ -0,0 +1,93 @@
+#ifndef DURABLE_FILE_HPP
+#define DURABLE_FILE_HPP
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* @brief Persist the directory entry of path, needed after a create or
+ *        rename for the name itself to survive a crash
+ * @param path File whose parent directory is synced
+ * @return false if the directory could not be synced
+ */
+static inline bool SyncParentDir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/* @brief Write all of iov to fd in as few writev calls as the kernel allows,
+ *        short writes resume where they stopped
+ * @param iov Advanced past the written bytes, contents are left alone
+ * @return false on a write error
+ */
+static inline bool WriteAll(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Temp file beside path that replaces it in one rename, readers see either
+// the old or the new content and a crash never leaves a half written file.
+struct AtomicFile {
+    std::string path;
+    std::string tmp;
+    int fd;
+};
+
+static inline bool AtomicFileOpen(AtomicFile* af, const std::string& path) {
+    af->path = path;
+    af->tmp = path + ".XXXXXX";
+    af->fd = mkstemp(&af->tmp[0]);
+    if (af->fd < 0) {
+        return false;
+    }
+    // mkstemp creates 0600, snapshots are shared like any other file
+    fchmod(af->fd, 0644);
+    return true;
+}
+
+/* @brief Make the written content durable and move it over path
+ * @param af Opened by AtomicFileOpen, closed on return
+ * @param ok false if writing failed, the temp file is dropped then
+ * @return true once path holds the new content on disk
+ */
+static inline bool AtomicFileCommit(AtomicFile* af, bool ok) {
+    ok = ok && fsync(af->fd) == 0;
+    ok = close(af->fd) == 0 && ok;
+    af->fd = -1;
+    ok = ok && rename(af->tmp.c_str(), af->path.c_str()) == 0;
+    if (!ok) {
+        unlink(af->tmp.c_str());
+        return false;
+    }
+    return SyncParentDir(af->path);
+}
+
+#endif // DURABLE_FILE_HPP
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <string>
 
 static inline void ErrorIf(bool cond, const char* func, int line, const char* fmt, ...) {
     if (cond) {
@@ -19,4 +20,32 @@ static inline void ErrorIf(bool cond, const char* func, int line, const char* fm
 
 #define ErrIf(cond, fmt, ...) ErrorIf(cond, __func__, __LINE__, fmt, ##__VA_ARGS__)
 
+// Message of the last error reported through ErrRetIf. Not static, every
+// translation unit has to share the one buffer.
+inline std::string& ErrLast() {
+    static std::string last;
+    return last;
+}
+
+static inline bool ErrorRetIf(bool cond, const char* fmt, ...) {
+    if (cond) {
+        char buf[256];
+        std::va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        ErrLast() = buf;
+    }
+    return cond;
+}
+
+// For errors a single command can fail with: note the message in ErrLast
+// and return ret, the caller decides whether that ends the process
+#define ErrRetIf(cond, ret, fmt, ...)                      \
+    do {                                                   \
+        if (ErrorRetIf(cond, fmt, ##__VA_ARGS__)) {        \
+            return ret;                                    \
+        }                                                  \
+    } while (0)
+
 #endif // ERR_HPP
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef FILE_LOCK_HPP
+#define FILE_LOCK_HPP
+
+#include <cerrno>
+#include <string>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// flock on a sidecar file shared by every process of one store. The
+// snapshot cannot carry the lock itself, it is replaced by rename and a
+// waiter would wake up holding a lock on the old inode.
+//
+// Going from LOCK_SH to LOCK_EX is not atomic, flock drops the shared lock
+// before it waits, so whatever was read under it has to be checked again.
+struct FileLock {
+    std::string path;
+    int fd;
+    // LOCK_UN, LOCK_SH or LOCK_EX
+    int mode;
+};
+
+static inline void FileLockInit(FileLock* lock, const std::string& path) {
+    lock->path = path;
+    lock->fd = -1;
+    lock->mode = LOCK_UN;
+}
+
+/* @brief Block until lock is held in mode, the lock file is created first
+ * @param mode LOCK_SH or LOCK_EX
+ * @return false if the lock file could not be opened or locked
+ */
+static inline bool FileLockAcquire(FileLock* lock, int mode) {
+    if (lock->fd < 0) {
+        lock->fd = open(lock->path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock->fd < 0) {
+            return false;
+        }
+    }
+    while (flock(lock->fd, mode) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    lock->mode = mode;
+    return true;
+}
+
+static inline void FileLockRelease(FileLock* lock) {
+    if (lock->mode != LOCK_UN) {
+        flock(lock->fd, LOCK_UN);
+        lock->mode = LOCK_UN;
+    }
+}
+
+static inline void FileLockClose(FileLock* lock) {
+    FileLockRelease(lock);
+    if (lock->fd >= 0) {
+        close(lock->fd);
+        lock->fd = -1;
+    }
+}
+
+// Identity, size and mtime of a file, all zero when it does not exist.
+// Files of a store are only replaced by rename or appended to, so equal
+// stamps mean nobody wrote the file in between.
+struct FileStamp {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+static inline FileStamp FileStampOf(const std::string& path) {
+    FileStamp stamp = {};
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        stamp.dev = st.st_dev;
+        stamp.ino = st.st_ino;
+        stamp.size = st.st_size;
+        stamp.mtime = st.st_mtim;
+    }
+    return stamp;
+}
+
+static inline bool FileStampEqual(const FileStamp& a, const FileStamp& b) {
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size
+        && a.mtime.tv_sec == b.mtime.tv_sec && a.mtime.tv_nsec == b.mtime.tv_nsec;
+}
+
+#endif // FILE_LOCK_HPP
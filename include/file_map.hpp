@@ -0,0 +1,74 @@
+#ifndef FILE_MAP_HPP
+#define FILE_MAP_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a whole file, always followed by at least one NUL so
+// the text parsers can run on it directly.
+struct FileMap {
+    const char* data;
+    size_t size;
+    // Length of the mapping, 0 if nothing is mapped
+    size_t map_size;
+};
+
+/* @brief Map path read-only with a sequential access hint
+ * @param fm Result, data is "" for a missing or empty file
+ * @param path File to map
+ * @return false if the file exists but could not be mapped
+ */
+static inline bool FileMapOpen(FileMap* fm, const char* path) {
+    fm->data = "";
+    fm->size = 0;
+    fm->map_size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = st.st_size;
+    // Reserve one zero page more than the file, then lay the file over it,
+    // so the byte after the last one is NUL even for page-sized files
+    size_t map_size = (size / page + 1) * page;
+    void* base = mmap(0, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, map_size);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    madvise(base, size, MADV_SEQUENTIAL);
+    fm->data = static_cast<const char*>(base);
+    fm->size = size;
+    fm->map_size = map_size;
+    return true;
+}
+
+static inline void FileMapClose(FileMap* fm) {
+    if (fm->map_size) {
+        munmap(const_cast<char*>(fm->data), fm->map_size);
+    }
+    fm->data = "";
+    fm->size = 0;
+    fm->map_size = 0;
+}
+
+#endif // FILE_MAP_HPP
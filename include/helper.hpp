@@ -3,26 +3,57 @@
 
 #include <iostream>
 #include <string>
-#include <chrono>
 #include <unordered_map>
 #include <map>
 #include <cstdarg>
+#include <cstdint>
 #include <vector>
 #include <sstream>
-#include <iomanip>
 #include "err.hpp"
 
-using SystemClock = std::chrono::system_clock;
-using SystemTimePoint = std::chrono::time_point<SystemClock>;
+static const char* const kTaskDataBaseName = "task.json";
+// Snapshot of the binary backend, picked with TTC_STORAGE=binary
+static const char* const kTaskBinaryName = "task.db";
+// Mutations since the last snapshot, replayed on top of it, kept next to
+// the snapshot under its name plus this suffix
+static const char* const kTaskLogSuffix = ".log";
+// Unix socket of a serving process, beside the snapshot under this suffix
+static const char* const kTaskSocketSuffix = ".sock";
+// A serving process folds its log into the snapshot after this long idle
+const int kServeIdleMs = 1000;
+// Advisory lock taken by every process of a store, beside the snapshot
+// under this suffix
+static const char* const kTaskLockSuffix = ".lock";
+// Search index over task descriptions, beside the snapshot under this suffix
+static const char* const kTaskTermsSuffix = ".terms";
+// Id to byte range index of the json snapshot, beside it under this suffix
+static const char* const kTaskIndexSuffix = ".idx";
+// Fold log into snapshot once it reaches this size...
+const size_t kLogCompactBytes = 4 * 1024 * 1024;
+// ...or this share of the snapshot, whichever comes first
+const double kLogCompactRatio = 0.5;
+// Never compact a log smaller than this
+const size_t kLogCompactMinBytes = 64 * 1024;
+// Sync delay that lets concurrent commands share one, TTC_COMMIT_DELAY_US.
+// Off by default so a lone command never waits, grouping across processes
+// is opt-in. The server groups the commands it holds regardless.
+const int kCommitDelayUs = 0;
 
-static const char* kTaskDataBaseName = "task.json";
+// Task ids are allocated from 1 upward, 0 is never a valid id
+typedef uint32_t TaskId;
+// Ids index a dense table, anything above this is rejected as corrupt
+const TaskId kMaxTaskId = (1u << 24) - 1;
+
+// Seconds since 1970-01-01 00:00:00 of the local wall clock reading, see
+// task_time.hpp. Never negative.
+typedef int64_t TaskTime;
 
 struct Task {
-    std::string id;
+    TaskId      id;
     std::string description;
     int         status;
-    std::string created_at;
-    std::string updated_at;
+    TaskTime    created_at;
+    TaskTime    updated_at;
 };
 
 const std::string kAddCmd        = "add";
@@ -31,6 +62,10 @@ const std::string kDeleteCmd     = "delete";
 const std::string kMarkProgCmd   = "mark-in-progress";
 const std::string kMarkDoneCmd   = "mark-done";
 const std::string kListCmd       = "list";
+const std::string kConvertCmd    = "convert";
+const std::string kBatchCmd      = "batch";
+const std::string kServeCmd      = "serve";
+const std::string kSearchCmd     = "search";
 
 static std::unordered_map<std::string, uint8_t> support_cmd = {
     {kAddCmd              , 3},
@@ -38,9 +73,23 @@ static std::unordered_map<std::string, uint8_t> support_cmd = {
     {kDeleteCmd           , 3},
     {kMarkProgCmd         , 3},
     {kMarkDoneCmd         , 3},
-    {kListCmd             , 2}
+    {kListCmd             , 2},
+    {kConvertCmd          , 3},
+    {kBatchCmd            , 2},
+    {kServeCmd            , 2},
+    {kSearchCmd           , 3}
 };
 
+// Command known and given enough arguments, the message goes to ErrLast
+// otherwise. argc counts like main's, program and command included.
+static inline bool CheckCommand(const std::string& cmd, size_t nargs) {
+    auto iter = support_cmd.find(cmd);
+    ErrRetIf(iter == support_cmd.end(), false, "Unsupport command: [%s].", cmd.c_str());
+    ErrRetIf(nargs + 2 < iter->second, false, "Unexpected argument count, expected: %d, got: %d.",
+             iter->second, (int)nargs + 2);
+    return true;
+}
+
 enum class TaskStatus {
     kUnknown = -1,
     kTodo,
@@ -56,15 +105,81 @@ static inline void ShowUsage(const std::string& prog_name) {
         << prog_name << " delete [task id]\r\n"
         << prog_name << " mark-in-progress [task id]\r\n"
         << prog_name << " mark-done [task id]\r\n"
-        << prog_name << " list [done|todo|in-progress]\r\n";
+        << prog_name << " list [done|todo|in-progress] [--limit N] [--offset N] [--format table|ndjson|csv|json]\r\n"
+        << "      [--sort [-]id|status|created|updated|description] [--min-id N] [--max-id N]\r\n"
+        << "      [--created-after T] [--created-before T] [--updated-after T] [--updated-before T]\r\n"
+        << prog_name << " search <words> [OR <words>] [--limit N] [--offset N] [--format F]\r\n"
+        << prog_name << " convert [file.json|file.db]\r\n"
+        << prog_name << " batch [file|-]\r\n"
+        << prog_name << " serve\r\n";
+}
+
+// Canonical decimal id in 1..kMaxTaskId, false for anything else
+static inline bool ParseTaskId(const char* str, size_t len, TaskId* id) {
+    if (len == 0 || len > 8 || str[0] == '0') {
+        return false;
+    }
+    uint32_t v = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+        v = v * 10 + (str[i] - '0');
+    }
+    if (v > kMaxTaskId) {
+        return false;
+    }
+    *id = v;
+    return true;
+}
+
+static inline bool ParseTaskId(const std::string& str, TaskId* id) {
+    return ParseTaskId(str.data(), str.size(), id);
 }
 
-static inline std::string GetCurrentTime(const char* fmt = "%Y-%m-%d %T") {
-    SystemTimePoint now = SystemClock::now();
-    std::ostringstream oss;
-    std::time_t now_t = SystemClock::to_time_t(now);
-    oss << std::put_time(localtime(&now_t), fmt);
-    return oss.str();
+/* @brief Split a command line into words on blanks, "..." keeps blanks
+ *        and takes \" and \\ escapes, '...' is taken literally
+ * @param line
+ * @param words Output, replaced
+ * @return false on an unterminated quote
+ */
+static inline bool SplitCommandLine(const std::string& line, std::vector<std::string>* words) {
+    words->clear();
+    size_t i = 0, n = line.size();
+    while (true) {
+        while (i < n && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) {
+            i++;
+        }
+        if (i == n) {
+            return true;
+        }
+        std::string word;
+        while (i < n && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+            char c = line[i++];
+            if (c == '\'') {
+                size_t end = line.find('\'', i);
+                if (end == std::string::npos) {
+                    return false;
+                }
+                word.append(line, i, end - i);
+                i = end + 1;
+            } else if (c == '"') {
+                while (i < n && line[i] != '"') {
+                    if (line[i] == '\\' && i + 1 < n && (line[i + 1] == '"' || line[i + 1] == '\\')) {
+                        i++;
+                    }
+                    word.push_back(line[i++]);
+                }
+                if (i == n) {
+                    return false;
+                }
+                i++;
+            } else {
+                word.push_back(c);
+            }
+        }
+        words->push_back(word);
+    }
 }
 
 #endif // TASK_HPP
\ No newline at end of file
@@ -1,13 +1,45 @@
+#ifndef HJSON_HPP
+#define HJSON_HPP
+
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <cfloat>
 #include <climits>
 #include <cstdio>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "hjson_pow5.hpp"
 
-#define DBL_EPSILON __DBL_EPSILON__
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define HJSON_X86_SIMD 1
+// Kernels load whole aligned blocks around the scanned bytes. Aligned loads
+// never cross a page, but may touch bytes outside the object asan knows of.
+#if defined(__clang__) || defined(__SANITIZE_ADDRESS__)
+#define HJSON_NO_SANITIZE __attribute__((no_sanitize_address))
+#else
+#define HJSON_NO_SANITIZE
+#endif
+#endif
 
 #define BUFFER_SIZE 32
 
+// Size of the reusable buffer HJson_writeTo drains to a descriptor
+#define HJSON_STREAM_BUFFER_SIZE (64 * 1024)
+
+// Default size of a single arena block, larger requests get their own block
+#define HJSON_ARENA_BLOCK_SIZE (64 * 1024)
+
+// Node memory comes from an arena, do not free node itself
+#define HJSON_FLAG_ARENA      0x01
+// String value not owned by node
+#define HJSON_FLAG_CONST_SV   0x02
+// Key not owned by node
+#define HJSON_FLAG_CONST_KEY  0x04
+
 static const char* ep;
 
 enum class ValueType {
@@ -25,6 +57,8 @@ struct HJson {
     struct HJson* next;
     // object/array value data domain
     struct HJson* child;
+    // Last child, keeps appends O(1)
+    struct HJson* tail;
     ValueType type;
     // integer/boolean value
     int biv;
@@ -34,26 +68,177 @@ struct HJson {
     char* sv;
     // key
     char* key;
+    // HJson_hashKey of key, compared before the key itself
+    unsigned int key_hash;
+    // HJSON_FLAG_*
+    int flags;
+};
+
+struct HJson_arenaBlock {
+    struct HJson_arenaBlock* next;
+    size_t used;
+    size_t size;
+};
+
+// Bump allocator for parsed trees, zero-initialized arena is ready to use.
+// Everything allocated from it is released at once by HJson_arenaRelease.
+struct HJson_arena {
+    HJson_arenaBlock* head;
+    // Interned keys, open addressing, repeated keys of a parse share one copy
+    struct HJson_internSlot* keys;
+    int key_count;
+    int key_capacity;
+};
+
+struct HJson_internSlot {
+    const char* str;
+    int len;
+    unsigned int hash;
+};
+
+// Parse state shared by all parse functions
+struct HJson_context {
+    HJson_arena* arena;
+    // Strings point into a writable input buffer
+    bool insitu;
 };
 
 struct HJson_buffer {
     char* buffer;
     int offset;
     int size;
+    // Drain to fd when full instead of growing
+    bool drain;
+    int fd;
+    // Sticky, set once a drain write failed
+    bool failed;
+    // Bytes already drained to fd
+    size_t drained;
 };
 
-static const char* HJson_parseValue(HJson* item, const char* value);
-static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf);
+static inline const char* HJson_parseValue(HJson* item, const char* value, HJson_context* ctx);
+static inline bool HJson_writeValue(HJson *const node, HJson_buffer * const buf);
+
+static inline void* HJson_arenaAlloc(HJson_arena* arena, size_t size) {
+    HJson_arenaBlock* block = arena->head;
+    // Keep every allocation pointer aligned
+    size = (size + 7) & ~(size_t)7;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > HJSON_ARENA_BLOCK_SIZE ? size : HJSON_ARENA_BLOCK_SIZE;
+        block = (HJson_arenaBlock*)malloc(sizeof(HJson_arenaBlock) + block_size);
+        if (!block) {
+            return 0;
+        }
+        block->used = 0;
+        block->size = block_size;
+        if (arena->head && size > HJSON_ARENA_BLOCK_SIZE) {
+            // Oversized block, keep bumping the current one
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+    void* ret = (char*)(block + 1) + block->used;
+    block->used += size;
+    return ret;
+}
+
+static inline void HJson_arenaRelease(HJson_arena* arena) {
+    HJson_arenaBlock* block = arena->head;
+    HJson_arenaBlock* next;
+    while (block) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = 0;
+    free(arena->keys);
+    arena->keys = 0;
+    arena->key_count = 0;
+    arena->key_capacity = 0;
+}
+
+// FNV-1a
+static inline unsigned int HJson_hashKey(const char* str, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; ++i) {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline bool HJson_internGrow(HJson_arena* arena) {
+    int capacity = arena->key_capacity ? arena->key_capacity * 2 : 64;
+    HJson_internSlot* slots = (HJson_internSlot*)calloc(capacity, sizeof(HJson_internSlot));
+    if (!slots) {
+        return false;
+    }
+    for (int i = 0; i < arena->key_capacity; ++i) {
+        HJson_internSlot* old = arena->keys + i;
+        if (!old->str) {
+            continue;
+        }
+        unsigned int at = old->hash & (capacity - 1);
+        while (slots[at].str) {
+            at = (at + 1) & (capacity - 1);
+        }
+        slots[at] = *old;
+    }
+    free(arena->keys);
+    arena->keys = slots;
+    arena->key_capacity = capacity;
+    return true;
+}
 
-static HJson* HJson_new() {
-    HJson* node = (HJson*)malloc(sizeof(HJson));
+// Shared arena copy of str, made on first sight
+static inline const char* HJson_intern(HJson_arena* arena, const char* str, int len, unsigned int hash) {
+    if (arena->key_count * 2 >= arena->key_capacity && !HJson_internGrow(arena)) {
+        return 0;
+    }
+    unsigned int mask = arena->key_capacity - 1;
+    unsigned int at = hash & mask;
+    for (;;) {
+        HJson_internSlot* slot = arena->keys + at;
+        if (!slot->str) {
+            char* copy = (char*)HJson_arenaAlloc(arena, len + 1);
+            if (!copy) {
+                return 0;
+            }
+            memcpy(copy, str, len);
+            copy[len] = '\0';
+            slot->str = copy;
+            slot->len = len;
+            slot->hash = hash;
+            arena->key_count++;
+            return copy;
+        }
+        if (slot->hash == hash && slot->len == len && !memcmp(slot->str, str, len)) {
+            return slot->str;
+        }
+        at = (at + 1) & mask;
+    }
+}
+
+static inline HJson* HJson_new(HJson_arena* arena = 0) {
+    HJson* node = 0;
+    if (arena) {
+        node = (HJson*)HJson_arenaAlloc(arena, sizeof(HJson));
+    } else {
+        node = (HJson*)malloc(sizeof(HJson));
+    }
     if (node) {
         memset(node, 0, sizeof(HJson));
+        if (arena) {
+            node->flags = HJSON_FLAG_ARENA;
+        }
     }
     return node;
 }
 
-static void HJson_delete(HJson* node) {
+static inline void HJson_delete(HJson* node) {
     HJson* next;
     while (node) {
         next = node->next;
@@ -62,109 +247,561 @@ static void HJson_delete(HJson* node) {
             && node->child) {
             HJson_delete(node->child);
         }
-        if (node->type == ValueType::kString && node->sv) {
+        if (node->type == ValueType::kString && node->sv
+            && !(node->flags & HJSON_FLAG_CONST_SV)) {
             free(node->sv);
         }
-        if (node->key) {
+        if (node->key && !(node->flags & HJSON_FLAG_CONST_KEY)) {
             free(node->key);
         }
-        free(node);
+        if (!(node->flags & HJSON_FLAG_ARENA)) {
+            free(node);
+        }
         node = next;
     }
 }
 
-static const char* skip(const char* p) {
-    while (p && *p && (unsigned char)*p <= 32) {
+// Return first byte that is not whitespace (any byte <= 32 except NUL)
+static inline const char* HJson_skipScalar(const char* p) {
+    while (*p && (unsigned char)*p <= 32) {
+        p++;
+    }
+    return p;
+}
+
+// Return first '"', '\\' or NUL
+static inline const char* HJson_scanStringScalar(const char* p) {
+    while (*p && *p != '\"' && *p != '\\') {
         p++;
     }
     return p;
 }
 
-static const char* HJson_parseNumber(HJson* item, const char* value) {
+#ifdef HJSON_X86_SIMD
+HJSON_NO_SANITIZE __attribute__((target("sse2")))
+static inline const char* HJson_skipSSE2(const char* p) {
+    const __m128i space = _mm_set1_epi8(32);
+    const __m128i zero = _mm_setzero_si128();
+    uintptr_t misalign = (uintptr_t)p & 15;
+    const char* block = p - misalign;
+    unsigned int mask = 0xFFFFu << misalign;
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        __m128i ws = _mm_cmpeq_epi8(_mm_max_epu8(v, space), space);
+        __m128i nul = _mm_cmpeq_epi8(v, zero);
+        mask &= (~_mm_movemask_epi8(ws) | _mm_movemask_epi8(nul)) & 0xFFFF;
+        if (mask) {
+            return block + __builtin_ctz(mask);
+        }
+        block += 16;
+        mask = 0xFFFF;
+    }
+}
+
+HJSON_NO_SANITIZE __attribute__((target("sse2")))
+static inline const char* HJson_scanStringSSE2(const char* p) {
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    uintptr_t misalign = (uintptr_t)p & 15;
+    const char* block = p - misalign;
+    unsigned int mask = 0xFFFFu << misalign;
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                                   _mm_cmpeq_epi8(v, zero));
+        mask &= _mm_movemask_epi8(hit);
+        if (mask) {
+            return block + __builtin_ctz(mask);
+        }
+        block += 16;
+        mask = 0xFFFF;
+    }
+}
+
+HJSON_NO_SANITIZE __attribute__((target("avx2")))
+static inline const char* HJson_skipAVX2(const char* p) {
+    const __m256i space = _mm256_set1_epi8(32);
+    const __m256i zero = _mm256_setzero_si256();
+    uintptr_t misalign = (uintptr_t)p & 31;
+    const char* block = p - misalign;
+    unsigned int mask = 0xFFFFFFFFu << misalign;
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i ws = _mm256_cmpeq_epi8(_mm256_max_epu8(v, space), space);
+        __m256i nul = _mm256_cmpeq_epi8(v, zero);
+        mask &= ~(unsigned int)_mm256_movemask_epi8(ws) | (unsigned int)_mm256_movemask_epi8(nul);
+        if (mask) {
+            return block + __builtin_ctz(mask);
+        }
+        block += 32;
+        mask = 0xFFFFFFFFu;
+    }
+}
+
+HJSON_NO_SANITIZE __attribute__((target("avx2")))
+static inline const char* HJson_scanStringAVX2(const char* p) {
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i slash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    uintptr_t misalign = (uintptr_t)p & 31;
+    const char* block = p - misalign;
+    unsigned int mask = 0xFFFFFFFFu << misalign;
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, slash)),
+                                      _mm256_cmpeq_epi8(v, zero));
+        mask &= (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return block + __builtin_ctz(mask);
+        }
+        block += 32;
+        mask = 0xFFFFFFFFu;
+    }
+}
+#endif // HJSON_X86_SIMD
+
+typedef const char* (*HJson_scanFn)(const char*);
+
+struct HJson_kernels {
+    HJson_scanFn skip;
+    HJson_scanFn scan_string;
+};
+
+// Pick the widest kernels the running cpu supports
+static inline HJson_kernels HJson_selectKernels() {
+    HJson_kernels k = { HJson_skipScalar, HJson_scanStringScalar };
+#ifdef HJSON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        k.skip = HJson_skipAVX2;
+        k.scan_string = HJson_scanStringAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        k.skip = HJson_skipSSE2;
+        k.scan_string = HJson_scanStringSSE2;
+    }
+#endif // HJSON_X86_SIMD
+    return k;
+}
+
+static const HJson_kernels HJson_kernel = HJson_selectKernels();
+
+static inline const char* skip(const char* p) {
+    if (!p || (unsigned char)*p > 32 || !*p) {
+        // Compact json mostly lands here
+        return p;
+    }
+    return HJson_kernel.skip(p + 1);
+}
+
+// Saturating double to int, for biv
+static inline int HJson_toInt(double v) {
+    if (v >= INT_MAX) {
+        return INT_MAX;
+    }
+    if (v <= INT_MIN) {
+        return INT_MIN;
+    }
+    return static_cast<int>(v);
+}
+
+// Exactly representable powers of ten
+static const double HJson_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifdef __SIZEOF_INT128__
+/* @brief Eisel-Lemire, correctly rounded w * 10^q for w with at most 19 digits
+ * @param w Decimal significand, not zero
+ * @param q Decimal exponent
+ * @param out Result on success
+ * @return false if out of the table range, caller falls back
+ */
+static inline bool HJson_eiselLemire(uint64_t w, int64_t q, double* out) {
+    uint64_t bits = 0;
+    if (q < HJSON_POW5_MIN) {
+        *out = 0.0;
+        return true;
+    }
+    if (q > HJSON_POW5_MAX) {
+        bits = (uint64_t)0x7FF << 52;
+        memcpy(out, &bits, sizeof(bits));
+        return true;
+    }
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    const uint64_t* pow5 = HJson_pow5_128 + 2 * (q - HJSON_POW5_MIN);
+    unsigned __int128 first = (unsigned __int128)w * pow5[0];
+    uint64_t high = (uint64_t)(first >> 64);
+    uint64_t low = (uint64_t)first;
+    // Only the top 55 bits matter, refine with the low word when they may carry
+    const uint64_t precision_mask = 0xFFFFFFFFFFFFFFFFull >> 55;
+    if ((high & precision_mask) == precision_mask) {
+        unsigned __int128 second = (unsigned __int128)w * pow5[1];
+        uint64_t second_high = (uint64_t)(second >> 64);
+        low += second_high;
+        if (second_high > low) {
+            high++;
+        }
+    }
+    int upperbit = (int)(high >> 63);
+    int shift = upperbit + 64 - 52 - 3;
+    uint64_t mantissa = high >> shift;
+    int32_t power2 = (int32_t)((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz + 1023;
+    if (power2 <= 0) {
+        // Subnormal
+        if (-power2 + 1 >= 64) {
+            *out = 0.0;
+            return true;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += (mantissa & 1);
+        mantissa >>= 1;
+        power2 = (mantissa < ((uint64_t)1 << 52)) ? 0 : 1;
+        bits = mantissa | ((uint64_t)power2 << 52);
+        memcpy(out, &bits, sizeof(bits));
+        return true;
+    }
+    // Halfway case, round to even
+    if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+        && (mantissa << shift) == high) {
+        mantissa &= ~(uint64_t)1;
+    }
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    if (mantissa >= ((uint64_t)2 << 52)) {
+        mantissa = (uint64_t)1 << 52;
+        power2++;
+    }
+    mantissa &= ~((uint64_t)1 << 52);
+    if (power2 >= 0x7FF) {
+        power2 = 0x7FF;
+        mantissa = 0;
+    }
+    bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(out, &bits, sizeof(bits));
+    return true;
+}
+#endif // __SIZEOF_INT128__
+
+static inline const char* HJson_parseNumber(HJson* item, const char* value) {
+    const char* start = value;
+    bool negative = false;
+    bool integer = true;
+    // Set once a non zero digit did not fit in significand
+    bool truncated = false;
+    uint64_t significand = 0;
+    int digits = 0;
+    int64_t exponent = 0;
     double num = 0;
-    int num_sign = 1;
-    int scale = 0;
-    int exponent = 0;
-    int exponent_sign = 1;
+
     if (*value == '-') {
-        num_sign = -1;
+        negative = true;
         value++;
     }
-    // Leading zero?
-    while (value && *value == '0') {
-        value++;
+    if (*value < '0' || *value > '9') {
+        ep = start;
+        return 0;
     }
-    // Number?
-    if (value && *value >= '1' && *value <= '9') {
-        do
-        {
-            num = num * 10.0 + (*value++ - '0');
-        } while (value && *value >= '0' && *value <= '9');
+    // Integer part, leading zeros never count as significant
+    while (*value >= '0' && *value <= '9') {
+        if (digits < 19) {
+            significand = significand * 10 + (*value - '0');
+            digits += significand != 0;
+        } else {
+            truncated |= *value != '0';
+            exponent++;
+        }
+        value++;
     }
     // Double?
-    if (value && *value == '.') {
+    if (*value == '.') {
+        integer = false;
         value++;
-        while (value && *value >= '0' && *value <= '9') {
-            num = num * 10.0 + (*value++ - '0');
-            scale--;
+        if (*value < '0' || *value > '9') {
+            ep = start;
+            return 0;
+        }
+        while (*value >= '0' && *value <= '9') {
+            if (digits < 19) {
+                significand = significand * 10 + (*value - '0');
+                digits += significand != 0;
+                exponent--;
+            } else {
+                truncated |= *value != '0';
+            }
+            value++;
         }
     }
     // Exponent?
-    if (value && (*value == 'e' || *value == 'E')) {
+    if (*value == 'e' || *value == 'E') {
+        integer = false;
         value++;
-        if (value && *value == '-') {
+        int exponent_sign = 1;
+        int64_t e = 0;
+        if (*value == '-') {
             exponent_sign = -1;
             value++;
-        } else if (value && *value == '+') {
+        } else if (*value == '+') {
             value++;
         }
-        while (value && *value >= '0' && *value <= '9') {
-            exponent = exponent * 10 + (*value++ - '0');
+        if (*value < '0' || *value > '9') {
+            ep = start;
+            return 0;
+        }
+        while (*value >= '0' && *value <= '9') {
+            // Anything past this is zero or infinity anyway
+            if (e < 100000) {
+                e = e * 10 + (*value - '0');
+            }
+            value++;
         }
+        exponent += exponent_sign * e;
     }
 
-    num = num_sign * num * pow(10.0, (scale + exponent_sign * exponent));
-
     item->type = ValueType::kNumber;
-    item->dv = num;
-    item->biv = static_cast<int>(num);
-
+    if (integer && !truncated && exponent == 0) {
+        // Integer fast path, no floating point arithmetic
+        num = (double)significand;
+        item->dv = negative ? -num : num;
+        if (significand > (uint64_t)INT_MAX + (negative ? 1 : 0)) {
+            item->biv = negative ? INT_MIN : INT_MAX;
+        } else {
+            item->biv = negative ? (int)(0 - significand) : (int)significand;
+        }
+        return value;
+    }
+    if (significand == 0 && !truncated) {
+        num = 0.0;
+    } else if (!truncated && significand <= ((uint64_t)1 << 53)
+               && exponent >= -22 && exponent <= 22) {
+        // Clinger fast path, both operands exact so one rounding
+        num = (double)significand;
+        num = exponent < 0 ? num / HJson_pow10[-exponent] : num * HJson_pow10[exponent];
+#ifdef __SIZEOF_INT128__
+    } else if (!truncated && HJson_eiselLemire(significand, exponent, &num)) {
+        // Correctly rounded
+#endif // __SIZEOF_INT128__
+    } else {
+        // More than 19 significant digits, leave it to libc
+        num = strtod(negative ? start + 1 : start, 0);
+    }
+    item->dv = negative ? -num : num;
+    item->biv = HJson_toInt(item->dv);
     return value;
 }
 
-// TODO: Escape handle
-static const char* HJson_parseString(HJson* item, const char* value) {
+static inline unsigned int HJson_parseHex4(const char* p) {
+    unsigned int h = 0;
+    for (int i = 0; i < 4; ++i) {
+        h <<= 4;
+        if (p[i] >= '0' && p[i] <= '9') {
+            h += p[i] - '0';
+        } else if (p[i] >= 'a' && p[i] <= 'f') {
+            h += p[i] - 'a' + 10;
+        } else if (p[i] >= 'A' && p[i] <= 'F') {
+            h += p[i] - 'A' + 10;
+        } else {
+            return UINT_MAX;
+        }
+    }
+    return h;
+}
+
+// Decode escaped literal [sp, end) into dp, output never grows so dp may
+// alias sp. Return end of output, 0 if bad escape.
+static inline char* HJson_unescape(const char* sp, const char* end, char* dp) {
+    while (sp < end) {
+        if (*sp != '\\') {
+            *dp++ = *sp++;
+            continue;
+        }
+        sp++;
+        switch (*sp) {
+        case 'b': *dp++ = '\b'; break;
+        case 'f': *dp++ = '\f'; break;
+        case 'n': *dp++ = '\n'; break;
+        case 'r': *dp++ = '\r'; break;
+        case 't': *dp++ = '\t'; break;
+        case '\"':
+        case '\\':
+        case '/':
+            *dp++ = *sp;
+            break;
+        case 'u': {
+            if (end - sp < 5) {
+                return 0;
+            }
+            unsigned int uc = HJson_parseHex4(sp + 1);
+            sp += 4;
+            if (uc == UINT_MAX || (uc >= 0xDC00 && uc <= 0xDFFF)) {
+                return 0;
+            }
+            if (uc >= 0xD800 && uc <= 0xDBFF) {
+                // Surrogate pair
+                if (end - sp < 7 || sp[1] != '\\' || sp[2] != 'u') {
+                    return 0;
+                }
+                unsigned int lc = HJson_parseHex4(sp + 3);
+                if (lc < 0xDC00 || lc > 0xDFFF) {
+                    return 0;
+                }
+                sp += 6;
+                uc = 0x10000 + (((uc & 0x3FF) << 10) | (lc & 0x3FF));
+            }
+            // UTF-8 encode
+            if (uc < 0x80) {
+                *dp++ = (char)uc;
+            } else if (uc < 0x800) {
+                *dp++ = (char)(0xC0 | (uc >> 6));
+                *dp++ = (char)(0x80 | (uc & 0x3F));
+            } else if (uc < 0x10000) {
+                *dp++ = (char)(0xE0 | (uc >> 12));
+                *dp++ = (char)(0x80 | ((uc >> 6) & 0x3F));
+                *dp++ = (char)(0x80 | (uc & 0x3F));
+            } else {
+                *dp++ = (char)(0xF0 | (uc >> 18));
+                *dp++ = (char)(0x80 | ((uc >> 12) & 0x3F));
+                *dp++ = (char)(0x80 | ((uc >> 6) & 0x3F));
+                *dp++ = (char)(0x80 | (uc & 0x3F));
+            }
+            break;
+        }
+        default:
+            return 0;
+        }
+        sp++;
+    }
+    return dp;
+}
+
+// Find closing quote of the literal opening at value, 0 if unterminated
+static inline const char* HJson_findQuote(const char* value, bool* escaped) {
     const char* end_ptr = value + 1;
+    *escaped = false;
+    for (;;) {
+        end_ptr = HJson_kernel.scan_string(end_ptr);
+        if (*end_ptr != '\\') {
+            break;
+        }
+        *escaped = true;
+        if (!*++end_ptr) {
+            break;
+        }
+        end_ptr++;
+    }
+    if (!*end_ptr) {
+        ep = value;
+        return 0;
+    }
+    return end_ptr;
+}
+
+static inline const char* HJson_parseString(HJson* item, const char* value, HJson_context* ctx) {
+    const char* end_ptr = 0;
     int str_len = 0;
+    bool escaped = false;
     char* sb = 0;
     
     if (value && *value != '\"') {
         ep = value;
         return 0;
     }
-    while (end_ptr && *end_ptr != '\"') {
-        end_ptr++;
+    end_ptr = HJson_findQuote(value, &escaped);
+    if (!end_ptr) {
+        // Unterminated
+        return 0;
     }
     str_len = end_ptr - value - 1;
-    sb = (char*)malloc(str_len + 1);
+    if (ctx->insitu) {
+        // Point into the input buffer, terminate in place
+        sb = const_cast<char*>(value + 1);
+    } else if (ctx->arena) {
+        sb = (char*)HJson_arenaAlloc(ctx->arena, str_len + 1);
+    } else {
+        sb = (char*)malloc(str_len + 1);
+    }
     if (!sb) {
         return 0;
     }
     item->type = ValueType::kString;
     item->sv = sb;
+    if (ctx->insitu || ctx->arena) {
+        item->flags |= HJSON_FLAG_CONST_SV;
+    }
 
     // Get string literal
-    const char* sp = value + 1;
-    char* dp = sb;
-    while (sp < end_ptr) {
-        *dp++ = *sp++;
+    char* dp = sb + str_len;
+    if (escaped) {
+        dp = HJson_unescape(value + 1, end_ptr, sb);
+        if (!dp) {
+            item->sv = 0;
+            if (!(item->flags & HJSON_FLAG_CONST_SV)) {
+                free(sb);
+            }
+            ep = value;
+            return 0;
+        }
+    } else if (!ctx->insitu) {
+        memcpy(sb, value + 1, str_len);
     }
     *dp = '\0';
-    if (*sp == '\"') sp++;
-    return sp;
+    return end_ptr + 1;
+}
+
+// Parsed string value becomes the key, ownership follows
+static inline void HJson_moveKey(HJson* item) {
+    item->key = item->sv;
+    item->sv = 0;
+    item->key_hash = HJson_hashKey(item->key, strlen(item->key));
+    if (item->flags & HJSON_FLAG_CONST_SV) {
+        item->flags &= ~HJSON_FLAG_CONST_SV;
+        item->flags |= HJSON_FLAG_CONST_KEY;
+    }
 }
 
-static const char* HJson_parseArray(HJson* item, const char* value) {
+// Parse object key, interned when the tree lives in an arena
+static inline const char* HJson_parseKey(HJson* item, const char* value, HJson_context* ctx) {
+    bool escaped = false;
+    if (!ctx->arena || ctx->insitu) {
+        // In situ keys already cost nothing
+        value = HJson_parseString(item, value, ctx);
+        if (value) {
+            HJson_moveKey(item);
+        }
+        return value;
+    }
+    if (*value != '\"') {
+        ep = value;
+        return 0;
+    }
+    const char* end_ptr = HJson_findQuote(value, &escaped);
+    if (!end_ptr) {
+        return 0;
+    }
+    const char* str = value + 1;
+    int len = end_ptr - str;
+    if (escaped) {
+        // Decode into the arena first, rare for keys
+        if (!HJson_parseString(item, value, ctx)) {
+            return 0;
+        }
+        str = item->sv;
+        len = strlen(str);
+        item->sv = 0;
+        item->flags &= ~HJSON_FLAG_CONST_SV;
+    }
+    item->key_hash = HJson_hashKey(str, len);
+    item->key = const_cast<char*>(HJson_intern(ctx->arena, str, len, item->key_hash));
+    if (!item->key) {
+        return 0;
+    }
+    item->flags |= HJSON_FLAG_CONST_KEY;
+    return end_ptr + 1;
+}
+
+static inline const char* HJson_parseArray(HJson* item, const char* value, HJson_context* ctx) {
     HJson* child;
     if (value && *value != '[') {
         ep = value;
@@ -176,9 +813,9 @@ static const char* HJson_parseArray(HJson* item, const char* value) {
     if (value && *value == ']') {
         return value + 1;
     }
-    item->child = child = HJson_new();
+    item->child = child = HJson_new(ctx->arena);
 
-    value = skip(HJson_parseValue(child, skip(value)));
+    value = skip(HJson_parseValue(child, skip(value), ctx));
     if (!value) {
         return 0;
     }
@@ -186,20 +823,21 @@ static const char* HJson_parseArray(HJson* item, const char* value) {
     // Comma separator
     while (value && *value == ',') {
         HJson* next;
-        next = HJson_new();
+        next = HJson_new(ctx->arena);
         if (!next) {
             return 0;
         }
         child->next = next;
         child = next;
 
-        value = skip(HJson_parseValue(child, skip(value + 1)));
+        value = skip(HJson_parseValue(child, skip(value + 1), ctx));
         if (!value) {
             return 0;
         }
     }
     // ending
     if (value && *value == ']') {
+        item->tail = child;
         return value + 1;
     }
 
@@ -207,7 +845,7 @@ static const char* HJson_parseArray(HJson* item, const char* value) {
     return 0;
 }
 
-static const char* HJson_parseObject(HJson* item, const char* value) {
+static inline const char* HJson_parseObject(HJson* item, const char* value, HJson_context* ctx) {
     HJson* child;
     if (value && *value != '{') {
         ep = value;
@@ -219,27 +857,25 @@ static const char* HJson_parseObject(HJson* item, const char* value) {
         // Empty object
         return value + 1;
     }
-    item->child = child = HJson_new();
+    item->child = child = HJson_new(ctx->arena);
     // Find key
-    value = skip(HJson_parseString(child, skip(value)));
+    value = skip(HJson_parseKey(child, skip(value), ctx));
     if (!value) {
         return 0;
     }
-    child->key = child->sv;
-    child->sv = 0;
     if (value && *value != ':') {
         ep = value;
         return 0;
     }
     // Find value
-    value = skip(HJson_parseValue(child, skip(value + 1)));
+    value = skip(HJson_parseValue(child, skip(value + 1), ctx));
     if (!value) {
         return 0;
     }
     // Comma separator
     while (value && *value == ',') {
         HJson* next;
-        next = HJson_new();
+        next = HJson_new(ctx->arena);
         if (!next) {
             return 0;
         }
@@ -247,18 +883,16 @@ static const char* HJson_parseObject(HJson* item, const char* value) {
         child = next;
 
         // Parse again
-        value = skip(HJson_parseString(child, skip(value + 1)));
+        value = skip(HJson_parseKey(child, skip(value + 1), ctx));
         if (!value) {
             return 0;
         }
 
-        child->key = child->sv;
-        child->sv = 0;
         if (value && *value != ':') {
             ep = value;
             return 0;
         }
-        value = skip(HJson_parseValue(child, skip(value + 1)));
+        value = skip(HJson_parseValue(child, skip(value + 1), ctx));
         if (!value) {
             return 0;
         }
@@ -266,6 +900,7 @@ static const char* HJson_parseObject(HJson* item, const char* value) {
 
     // ending
     if (value && *value == '}') {
+        item->tail = child;
         return value + 1;
     }
 
@@ -273,7 +908,7 @@ static const char* HJson_parseObject(HJson* item, const char* value) {
     return 0;
 }
 
-static const char* HJson_parseValue(HJson* item, const char* value) {
+static inline const char* HJson_parseValue(HJson* item, const char* value, HJson_context* ctx) {
     if (!value) return 0;
 
     if (!strncmp(value, "null", 4)) {
@@ -291,36 +926,454 @@ static const char* HJson_parseValue(HJson* item, const char* value) {
         return value + 4;
     }
     if (*value == '\"') {
-        return HJson_parseString(item, value);
+        return HJson_parseString(item, value, ctx);
     }
     if (*value == '-' || (*value >= '0' && *value <= '9')) {
         return HJson_parseNumber(item, value);
     }
     if (*value == '{') {
-        return HJson_parseObject(item, value);
+        return HJson_parseObject(item, value, ctx);
     }
     if (*value == '[') {
-        return HJson_parseArray(item, value);
+        return HJson_parseArray(item, value, ctx);
     }
     ep = value;
     return 0;
 }
 
-static HJson* HJson_parse(const char* value) {
-    HJson* root_node = HJson_new();
+/* @brief Parse json text into a tree
+ * @param value NUL-terminated json text
+ * @param arena Optional, nodes and strings are bump-allocated from it and
+ *              the tree is released with HJson_arenaRelease instead of HJson_delete
+ * @return Root node, 0 if parse failed
+ */
+static inline HJson* HJson_parse(const char* value, HJson_arena* arena = 0) {
+    HJson_context ctx = { arena, false };
+    HJson* root_node = HJson_new(arena);
     if (!root_node) {
         return nullptr;
     }
     const char* end = 0;
-    end = HJson_parseValue(root_node, skip(value));
+    end = HJson_parseValue(root_node, skip(value), &ctx);
     if (!end) {
         // parse failed
         HJson_delete(root_node);
+        return nullptr;
     }
     return root_node;
 }
 
-static char* HJson_avoid(HJson_buffer * const p, int needed) {
+/* @brief Parse json text in place, strings point into value and are
+ *        terminated there, escaped ones are decoded in place as well
+ * @param value Writable NUL-terminated json text, must outlive the tree
+ * @param arena Optional, see HJson_parse
+ * @return Root node, 0 if parse failed
+ */
+static inline HJson* HJson_parseInSitu(char* value, HJson_arena* arena = 0) {
+    HJson_context ctx = { arena, true };
+    HJson* root_node = HJson_new(arena);
+    if (!root_node) {
+        return nullptr;
+    }
+    const char* end = 0;
+    end = HJson_parseValue(root_node, skip(value), &ctx);
+    if (!end) {
+        // parse failed
+        HJson_delete(root_node);
+        return nullptr;
+    }
+    return root_node;
+}
+
+// Event callbacks for HJson_parseEvents, any may be left null. Strings are
+// not NUL-terminated and only valid during the call. Return false to stop.
+struct HJson_handler {
+    bool (*start_object)(void* ctx);
+    bool (*end_object)(void* ctx);
+    bool (*start_array)(void* ctx);
+    bool (*end_array)(void* ctx);
+    bool (*key)(void* ctx, const char* str, int len);
+    bool (*string)(void* ctx, const char* str, int len);
+    bool (*number)(void* ctx, double dv, int biv);
+    bool (*boolean)(void* ctx, bool v);
+    bool (*null)(void* ctx);
+};
+
+// Event parse state
+struct HJson_events {
+    const HJson_handler* handler;
+    void* ctx;
+    // Decoded escaped strings, reused across events
+    char* scratch;
+    int scratch_size;
+};
+
+static inline const char* HJson_eventValue(HJson_events* ev, const char* value);
+
+// Parse literal at value and pass it to cb without copying unless escaped
+static inline const char* HJson_eventString(HJson_events* ev, const char* value,
+                                     bool (*cb)(void*, const char*, int)) {
+    bool escaped = false;
+    if (*value != '\"') {
+        ep = value;
+        return 0;
+    }
+    const char* end_ptr = HJson_findQuote(value, &escaped);
+    if (!end_ptr) {
+        return 0;
+    }
+    const char* str = value + 1;
+    int len = end_ptr - str;
+    if (escaped) {
+        if (len + 1 > ev->scratch_size) {
+            char* grown = (char*)realloc(ev->scratch, len + 1);
+            if (!grown) {
+                return 0;
+            }
+            ev->scratch = grown;
+            ev->scratch_size = len + 1;
+        }
+        char* dp = HJson_unescape(str, end_ptr, ev->scratch);
+        if (!dp) {
+            ep = value;
+            return 0;
+        }
+        str = ev->scratch;
+        len = dp - ev->scratch;
+    }
+    if (cb && !cb(ev->ctx, str, len)) {
+        return 0;
+    }
+    return end_ptr + 1;
+}
+
+static inline const char* HJson_eventArray(HJson_events* ev, const char* value) {
+    const HJson_handler* h = ev->handler;
+    if (h->start_array && !h->start_array(ev->ctx)) {
+        return 0;
+    }
+    value = skip(value + 1);
+    if (*value != ']') {
+        value = skip(HJson_eventValue(ev, value));
+        while (value && *value == ',') {
+            value = skip(HJson_eventValue(ev, skip(value + 1)));
+        }
+        if (!value) {
+            return 0;
+        }
+        if (*value != ']') {
+            ep = value;
+            return 0;
+        }
+    }
+    if (h->end_array && !h->end_array(ev->ctx)) {
+        return 0;
+    }
+    return value + 1;
+}
+
+static inline const char* HJson_eventObject(HJson_events* ev, const char* value) {
+    const HJson_handler* h = ev->handler;
+    if (h->start_object && !h->start_object(ev->ctx)) {
+        return 0;
+    }
+    value = skip(value + 1);
+    if (*value != '}') {
+        for (;;) {
+            // Key
+            value = skip(HJson_eventString(ev, value, h->key));
+            if (!value) {
+                return 0;
+            }
+            if (*value != ':') {
+                ep = value;
+                return 0;
+            }
+            // Value
+            value = skip(HJson_eventValue(ev, skip(value + 1)));
+            if (!value) {
+                return 0;
+            }
+            if (*value != ',') {
+                break;
+            }
+            value = skip(value + 1);
+        }
+        if (*value != '}') {
+            ep = value;
+            return 0;
+        }
+    }
+    if (h->end_object && !h->end_object(ev->ctx)) {
+        return 0;
+    }
+    return value + 1;
+}
+
+static inline const char* HJson_eventValue(HJson_events* ev, const char* value) {
+    const HJson_handler* h = ev->handler;
+    if (!value) return 0;
+
+    if (!strncmp(value, "null", 4)) {
+        if (h->null && !h->null(ev->ctx)) {
+            return 0;
+        }
+        return value + 4;
+    }
+    if (!strncmp(value, "false", 5)) {
+        if (h->boolean && !h->boolean(ev->ctx, false)) {
+            return 0;
+        }
+        return value + 5;
+    }
+    if (!strncmp(value, "true", 4)) {
+        if (h->boolean && !h->boolean(ev->ctx, true)) {
+            return 0;
+        }
+        return value + 4;
+    }
+    if (*value == '\"') {
+        return HJson_eventString(ev, value, h->string);
+    }
+    if (*value == '-' || (*value >= '0' && *value <= '9')) {
+        HJson number = {};
+        value = HJson_parseNumber(&number, value);
+        if (value && h->number && !h->number(ev->ctx, number.dv, number.biv)) {
+            return 0;
+        }
+        return value;
+    }
+    if (*value == '{') {
+        return HJson_eventObject(ev, value);
+    }
+    if (*value == '[') {
+        return HJson_eventArray(ev, value);
+    }
+    ep = value;
+    return 0;
+}
+
+/* @brief Parse json text and report it as a stream of events, no tree is built
+ * @param value NUL-terminated json text
+ * @param handler Event callbacks
+ * @param ctx Passed to every callback
+ * @return true if the whole document was parsed and no callback stopped it
+ */
+static inline bool HJson_parseEvents(const char* value, const HJson_handler* handler, void* ctx) {
+    HJson_events ev = { handler, ctx, 0, 0 };
+    const char* end = HJson_eventValue(&ev, skip(value));
+    free(ev.scratch);
+    return end != 0;
+}
+
+enum class HJson_streamState {
+    kBegin,
+    kItems,
+    kItem,
+    kDone,
+    kError
+};
+
+// Completed element text, NUL-terminated and valid during the call only.
+// Return false to stop.
+typedef bool (*HJson_itemFn)(void* ctx, const char* text, int len);
+
+/* Resumable push parser for a top-level array. Input arrives in chunks of
+ * any size, every element is handed to on_item as soon as the separator
+ * after it has been seen. Only the element in progress is buffered, so
+ * memory is bounded by the largest element, not by the document.
+ */
+struct HJson_stream {
+    HJson_itemFn on_item;
+    void* ctx;
+    HJson_streamState state;
+    // Nesting inside the current element
+    int depth;
+    bool in_string;
+    bool escape;
+    // Comma seen, another element must follow
+    bool need_item;
+    // Bytes of the current element
+    char* item;
+    int item_len;
+    int item_size;
+};
+
+static inline void HJson_streamInit(HJson_stream* st, HJson_itemFn on_item, void* ctx) {
+    memset(st, 0, sizeof(HJson_stream));
+    st->on_item = on_item;
+    st->ctx = ctx;
+    st->state = HJson_streamState::kBegin;
+}
+
+static inline void HJson_streamRelease(HJson_stream* st) {
+    free(st->item);
+    st->item = 0;
+    st->item_len = 0;
+    st->item_size = 0;
+}
+
+static inline bool HJson_streamAppend(HJson_stream* st, const char* p, int len) {
+    if (st->item_len + len + 1 > st->item_size) {
+        int new_size = st->item_size ? st->item_size : 256;
+        while (new_size < st->item_len + len + 1) {
+            new_size *= 2;
+        }
+        char* grown = (char*)realloc(st->item, new_size);
+        if (!grown) {
+            return false;
+        }
+        st->item = grown;
+        st->item_size = new_size;
+    }
+    memcpy(st->item + st->item_len, p, len);
+    st->item_len += len;
+    return true;
+}
+
+// Hand the finished element over, trailing blanks trimmed
+static inline bool HJson_streamEmit(HJson_stream* st) {
+    while (st->item_len > 0 && (unsigned char)st->item[st->item_len - 1] <= 32) {
+        st->item_len--;
+    }
+    if (!st->item_len) {
+        // Separator without element
+        return false;
+    }
+    st->item[st->item_len] = '\0';
+    bool ok = st->on_item(st->ctx, st->item, st->item_len);
+    st->item_len = 0;
+    return ok;
+}
+
+/* @brief Feed next chunk
+ * @return false on malformed input or when on_item stopped, the stream
+ *         then stays failed
+ */
+static inline bool HJson_streamFeed(HJson_stream* st, const char* chunk, size_t len) {
+    const char* p = chunk;
+    const char* end = chunk + len;
+    while (p < end) {
+        switch (st->state) {
+        case HJson_streamState::kBegin:
+            if ((unsigned char)*p <= 32) {
+                p++;
+            } else if (*p == '[') {
+                st->state = HJson_streamState::kItems;
+                p++;
+            } else {
+                st->state = HJson_streamState::kError;
+            }
+            break;
+        case HJson_streamState::kItems:
+            // Between elements
+            if ((unsigned char)*p <= 32) {
+                p++;
+            } else if (*p == ']' && !st->need_item) {
+                st->state = HJson_streamState::kDone;
+                p++;
+            } else if (*p == ',' || *p == ']') {
+                st->state = HJson_streamState::kError;
+            } else {
+                st->state = HJson_streamState::kItem;
+            }
+            break;
+        case HJson_streamState::kItem: {
+            // Copy the run up to the byte that ends this element
+            const char* run = p;
+            for (; p < end; ++p) {
+                char c = *p;
+                if (st->in_string) {
+                    if (st->escape) {
+                        st->escape = false;
+                    } else if (c == '\\') {
+                        st->escape = true;
+                    } else if (c == '\"') {
+                        st->in_string = false;
+                    }
+                } else if (c == '\"') {
+                    st->in_string = true;
+                } else if (c == '{' || c == '[') {
+                    st->depth++;
+                } else if ((c == '}' || c == ']') && st->depth > 0) {
+                    st->depth--;
+                } else if ((c == ',' || c == ']') && st->depth == 0) {
+                    break;
+                }
+            }
+            if (!HJson_streamAppend(st, run, p - run)) {
+                st->state = HJson_streamState::kError;
+                break;
+            }
+            if (p == end) {
+                break;
+            }
+            if (!HJson_streamEmit(st)) {
+                st->state = HJson_streamState::kError;
+                break;
+            }
+            st->need_item = *p == ',';
+            st->state = *p == ']' ? HJson_streamState::kDone : HJson_streamState::kItems;
+            p++;
+            break;
+        }
+        case HJson_streamState::kDone:
+            if ((unsigned char)*p > 32) {
+                // Trailing garbage
+                st->state = HJson_streamState::kError;
+            }
+            p++;
+            break;
+        case HJson_streamState::kError:
+            return false;
+        }
+    }
+    return st->state != HJson_streamState::kError;
+}
+
+// End of input, true if the array was complete
+static inline bool HJson_streamFinish(HJson_stream* st) {
+    return st->state == HJson_streamState::kDone;
+}
+
+// Write all iovecs to fd, retry on partial writes
+static inline bool HJson_writeAll(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Drain buffered bytes to fd
+static inline bool HJson_bufferFlush(HJson_buffer * const p) {
+    if (!p->drain || p->failed) {
+        return !p->failed;
+    }
+    if (p->offset > 0) {
+        struct iovec iov = { p->buffer, (size_t)p->offset };
+        p->failed = !HJson_writeAll(p->fd, &iov, 1);
+        p->drained += p->offset;
+        p->offset = 0;
+    }
+    return !p->failed;
+}
+
+static inline char* HJson_avoid(HJson_buffer * const p, int needed) {
     char* new_buf = 0;
     int new_size = 0;
     if (!p) {
@@ -331,6 +1384,9 @@ static char* HJson_avoid(HJson_buffer * const p, int needed) {
         p->offset = 0;
         p->size = BUFFER_SIZE;
     }
+    if (p->drain && p->offset + needed + 1 > p->size) {
+        HJson_bufferFlush(p);
+    }
     needed += p->offset + 1;
     if (needed <= p->size) {
         return p->buffer + p->offset;
@@ -350,70 +1406,145 @@ static char* HJson_avoid(HJson_buffer * const p, int needed) {
     return p->buffer + p->offset;
 }
 
-static void HJson_concat(HJson_buffer* const p, const char* v) {
+static inline void HJson_append(HJson_buffer* const p, const char* v, int v_len) {
     char* out = 0;
-    int v_len = strlen(v);
+    if (p->drain && p->buffer && p->offset + v_len + 1 > p->size && v_len >= p->size / 2) {
+        // Large payload, hand pending bytes and payload to one writev
+        struct iovec iov[2] = {
+            { p->buffer, (size_t)p->offset },
+            { const_cast<char*>(v), (size_t)v_len }
+        };
+        if (!p->failed) {
+            p->failed = !HJson_writeAll(p->fd, iov, 2);
+        }
+        p->drained += p->offset + v_len;
+        p->offset = 0;
+        return;
+    }
     out = HJson_avoid(p, v_len);
     if (out) {
-        strcpy(out, v);
+        memcpy(out, v, v_len);
         p->offset += v_len;
     }
 }
 
-static bool HJson_writeNumber(HJson *const node, HJson_buffer * const buf) {
-    char* out = 0;
+static inline void HJson_putc(HJson_buffer* const p, char c) {
+    if (p->buffer && p->offset + 1 < p->size) {
+        p->buffer[p->offset++] = c;
+        return;
+    }
+    char* out = HJson_avoid(p, 1);
+    if (out) {
+        *out = c;
+        p->offset++;
+    }
+}
+
+static inline void HJson_concat(HJson_buffer* const p, const char* v) {
+    HJson_append(p, v, strlen(v));
+}
+
+// Write v in decimal to out, return length
+static inline int HJson_writeInt64(char* out, int64_t v) {
+    uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+    int len = v < 0 ? 1 : 0;
+    uint64_t t = u;
+    do {
+        len++;
+        t /= 10;
+    } while (t);
+    char* dp = out + len;
+    do {
+        *--dp = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) {
+        *--dp = '-';
+    }
+    return len;
+}
+
+static inline bool HJson_writeNumber(HJson *const node, HJson_buffer * const buf) {
     double dv = node->dv;
-    int iv = node->biv;
-    if (dv < DBL_EPSILON) {
-        // Special zero
-        out = (char*)malloc(2);
-        if (out) {
-            strcpy(out, "0");
-        }
-    } else if (fabs((double)iv - dv) <= DBL_EPSILON && (dv <= INT_MAX) && (dv >= INT_MIN)) {
-        // Integer
-        out = (char*)malloc(21);
-        if (out) {
-            sprintf(out, "%d", iv);
-        }
+    // Longest %.17g output is 24 bytes
+    char* out = HJson_avoid(buf, 32);
+    int len = 0;
+    if (!out) {
+        return false;
+    }
+    if (dv != dv || dv - dv != 0) {
+        // NaN and infinity have no json form
+        memcpy(out, "null", 4);
+        len = 4;
+    } else if (dv == floor(dv) && fabs(dv) < 9007199254740992.0) {
+        // Integer, exact in double
+        len = HJson_writeInt64(out, (int64_t)dv);
     } else {
-        // Floating
-        out = (char*)malloc(64);
-        if (out) {
-            if ((dv * 0) != 0) {
-                sprintf(out, "null");
-            } else if (fabs(floor(dv) - dv) <= DBL_EPSILON && dv < 1.0e60) {
-                sprintf(out, "%0.f", dv);
-            } else if (fabs(dv) < 1.0e-6 || fabs(dv) > 1.0e9) {
-                sprintf(out, "%e", dv);
-            } else {
-                sprintf(out, "%f", dv);
+        // Shortest precision that reads back to the same double. Every
+        // decimal of up to 15 digits survives a normal double, so when 15
+        // digits read back %g has already cut them to the shortest form.
+        // Subnormals hold fewer digits and are searched from one up.
+        HJson check = {};
+        int first = fabs(dv) < DBL_MIN ? 1 : 15;
+        for (int precision = first; precision <= 17; ++precision) {
+            len = snprintf(out, 32, "%.*g", precision, dv);
+            HJson_parseNumber(&check, out);
+            if (check.dv == dv) {
+                break;
             }
         }
     }
-    if (out) {
-        HJson_concat(buf, out);
-        free(out);
-        return true;
+    buf->offset += len;
+    out[len] = '\0';
+    return true;
+}
+
+// Write quoted and escaped string, safe runs go out in one append
+static inline void HJson_writeQuotedLen(HJson_buffer * const buf, const char* str, int len) {
+    const char* run = str;
+    const char* sp = str;
+    const char* end = str + len;
+    char esc[8] = { '\\' };
+    int esc_len = 0;
+    HJson_putc(buf, '\"');
+    for (; sp < end; ++sp) {
+        unsigned char c = (unsigned char)*sp;
+        if (c >= 32 && c != '\"' && c != '\\') {
+            continue;
+        }
+        HJson_append(buf, run, sp - run);
+        run = sp + 1;
+        esc_len = 2;
+        switch (c) {
+        case '\"': esc[1] = '\"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc_len = 1 + snprintf(esc + 1, sizeof(esc) - 1, "u%04x", c);
+            break;
+        }
+        HJson_append(buf, esc, esc_len);
     }
-    free(out);
-    return false;
+    HJson_append(buf, run, sp - run);
+    HJson_putc(buf, '\"');
 }
 
-// TODO: Escaping handle
-static bool HJson_writeString(HJson *const node, HJson_buffer * const buf) {
-    const char* inner_sv = node->sv;
-    // Begin
-    HJson_concat(buf, "\"");
-    HJson_concat(buf, inner_sv);
-    // End
-    HJson_concat(buf, "\"");
+static inline void HJson_writeQuoted(HJson_buffer * const buf, const char* str) {
+    HJson_writeQuotedLen(buf, str, strlen(str));
+}
+
+static inline bool HJson_writeString(HJson *const node, HJson_buffer * const buf) {
+    HJson_writeQuoted(buf, node->sv);
     return true;
-}   
+}
 
-static bool HJson_writeArray(HJson *const node, HJson_buffer * const buf) {
+static inline bool HJson_writeArray(HJson *const node, HJson_buffer * const buf) {
     // Begin
-    HJson_concat(buf, "[");
+    HJson_putc(buf, '[');
     HJson* ptr = node->child;
     while (ptr) {
         if (!HJson_writeValue(ptr, buf)) {
@@ -422,28 +1553,26 @@ static bool HJson_writeArray(HJson *const node, HJson_buffer * const buf) {
         }
         if (ptr->next) {
             // Comma separator
-            HJson_concat(buf, ",");
+            HJson_putc(buf, ',');
         }
         ptr = ptr->next;
     }
     // End
-    HJson_concat(buf, "]");
+    HJson_putc(buf, ']');
     return true;
 }
 
-static bool HJson_writeObject(HJson *const node, HJson_buffer * const buf) {
+static inline bool HJson_writeObject(HJson *const node, HJson_buffer * const buf) {
     // Begin
-    HJson_concat(buf, "{");
+    HJson_putc(buf, '{');
     const char* obj_key = 0;
     HJson* ptr = node->child;
     while (ptr) {
         // Write key
         obj_key = ptr->key;
-        HJson_concat(buf, "\"");
-        HJson_concat(buf, obj_key);
-        HJson_concat(buf, "\"");
+        HJson_writeQuoted(buf, obj_key);
         // Write separator
-        HJson_concat(buf, ":");
+        HJson_putc(buf, ':');
         // Write value
         if (!HJson_writeValue(ptr, buf)) {
             // If failed, write double quotation.
@@ -451,16 +1580,16 @@ static bool HJson_writeObject(HJson *const node, HJson_buffer * const buf) {
         }
         // Write separator
         if (ptr->next) {
-            HJson_concat(buf, ",");
+            HJson_putc(buf, ',');
         }
         ptr = ptr->next;
     }
     //End
-    HJson_concat(buf, "}");
+    HJson_putc(buf, '}');
     return true;
 }
 
-static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
+static inline bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
     switch (node->type)
     {
     case ValueType::kArray:
@@ -468,13 +1597,13 @@ static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
     case ValueType::kObject:
         return HJson_writeObject(node, buf);
     case ValueType::kNull:
-        HJson_concat(buf, "null");
+        HJson_append(buf, "null", 4);
         return true;
     case ValueType::kBooleanTrue:
-        HJson_concat(buf, "true");
+        HJson_append(buf, "true", 4);
         return true;
     case ValueType::kBooleanFalse:
-        HJson_concat(buf, "false");
+        HJson_append(buf, "false", 5);
         return true;
     case ValueType::kNumber:
         return HJson_writeNumber(node, buf);
@@ -485,48 +1614,91 @@ static bool HJson_writeValue(HJson *const node, HJson_buffer * const buf) {
     }
 }
 
-static const char* HJson_write(HJson *const node, int& length) {
+/* @brief Serialize tree into memory
+ * @param node Root node
+ * @param length Output length
+ * @return NUL-terminated text owned by caller, release with free()
+ */
+static inline const char* HJson_write(HJson *const node, int& length) {
     if (!node) {
         return 0;
     }
-    HJson_buffer* inner_buffer;
-    inner_buffer = (HJson_buffer*)malloc(sizeof(HJson_buffer));
-    if (!inner_buffer) {
+    HJson_buffer inner_buffer = {};
+    if (!HJson_writeValue(node, &inner_buffer) || !HJson_avoid(&inner_buffer, 0)) {
+        free(inner_buffer.buffer);
         return 0;
     }
-    memset(inner_buffer, 0, sizeof(HJson_buffer));
-    if (!HJson_writeValue(node, inner_buffer)) {
-        free(inner_buffer->buffer);
-        free(inner_buffer);
-        return 0;
+    // Hand over the buffer itself
+    inner_buffer.buffer[inner_buffer.offset] = '\0';
+    length = inner_buffer.offset;
+    return inner_buffer.buffer;
+}
+
+// Streaming buffer over fd, release with HJson_bufferClose
+static inline bool HJson_bufferOpen(HJson_buffer* const buf, int fd, int size = HJSON_STREAM_BUFFER_SIZE) {
+    memset(buf, 0, sizeof(HJson_buffer));
+    buf->buffer = (char*)malloc(size);
+    if (!buf->buffer) {
+        return false;
     }
-    // Copy
-    char* ret_buf;
-    ret_buf = (char*)malloc(inner_buffer->offset + 1);
-    if (!ret_buf) {
-        return 0;
+    buf->size = size;
+    buf->drain = true;
+    buf->fd = fd;
+    return true;
+}
+
+// Bytes written so far, drained or pending
+static inline size_t HJson_bufferTell(const HJson_buffer* const buf) {
+    return buf->drained + buf->offset;
+}
+
+// Flush pending bytes and free buffer, return false if any write failed
+static inline bool HJson_bufferClose(HJson_buffer* const buf) {
+    bool ok = HJson_bufferFlush(buf);
+    free(buf->buffer);
+    buf->buffer = 0;
+    buf->offset = 0;
+    buf->size = 0;
+    return ok;
+}
+
+/* @brief Serialize tree through an open streaming buffer, pending bytes
+ *        stay buffered so several documents can share one buffer
+ * @return false if serialization or a drain write failed
+ */
+static inline bool HJson_writeTo(HJson *const node, HJson_buffer* const buf) {
+    if (!node) {
+        return false;
     }
-    length = inner_buffer->offset;
-    memset(ret_buf, 0, inner_buffer->offset + 1);
-    memcpy(ret_buf, inner_buffer->buffer, inner_buffer->offset + 1);
-    free(inner_buffer->buffer);
-    free(inner_buffer);
-    return ret_buf;
+    return HJson_writeValue(node, buf) && !buf->failed;
 }
 
-static HJson* HJson_createNumber(double v) {
+/* @brief Serialize tree straight to fd through a fixed size buffer, memory
+ *        use does not depend on document size
+ * @return false if serialization or any write failed
+ */
+static inline bool HJson_writeTo(HJson *const node, int fd) {
+    HJson_buffer buf;
+    if (!HJson_bufferOpen(&buf, fd)) {
+        return false;
+    }
+    bool ok = HJson_writeTo(node, &buf);
+    return HJson_bufferClose(&buf) && ok;
+}
+
+static inline HJson* HJson_createNumber(double v) {
     HJson* node = 0;
     node = HJson_new();
     if (!node) {
         return 0;
     }
     node->type = ValueType::kNumber;
-    node->biv = (int)v;
+    node->biv = HJson_toInt(v);
     node->dv = v;
     return node;
 }
 
-static HJson* HJson_createBoolean(bool v) {
+static inline HJson* HJson_createBoolean(bool v) {
     HJson* node = 0;
     node = HJson_new();
     if (!node) {
@@ -537,7 +1709,7 @@ static HJson* HJson_createBoolean(bool v) {
     return node;
 }
 
-static HJson* HJson_createString(const char* str) {
+static inline HJson* HJson_createString(const char* str) {
     HJson* node = 0;
     node = HJson_new();
     if (!node) {
@@ -548,7 +1720,7 @@ static HJson* HJson_createString(const char* str) {
     return node;
 }
 
-static HJson* HJson_createArray(void) {
+static inline HJson* HJson_createArray(void) {
     HJson* node = 0;
     node = HJson_new();
     if (!node) {
@@ -558,7 +1730,7 @@ static HJson* HJson_createArray(void) {
     return node;
 }
 
-static HJson* HJson_createObject(void) {
+static inline HJson* HJson_createObject(void) {
     HJson* node = 0;
     node = HJson_new();
     if (!node) {
@@ -568,28 +1740,107 @@ static HJson* HJson_createObject(void) {
     return node;
 }
 
-static void HJson_addItem(HJson* container, HJson* item) {
-    HJson* child = container->child;
+// Last child of container, walks only for trees linked by hand
+static inline HJson* HJson_lastChild(HJson* container) {
+    HJson* child = container->tail;
+    if (!child) {
+        child = container->child;
+        while (child && child->next) {
+            child = child->next;
+        }
+    }
+    return child;
+}
+
+// Last item of the chain starting at item, a detached chain is appended whole
+static inline HJson* HJson_chainEnd(HJson* item) {
+    while (item->next) {
+        item = item->next;
+    }
+    return item;
+}
+
+static inline void HJson_addItem(HJson* container, HJson* item) {
     if (!item) {
         return;
     }
-    if (!child) {
+    HJson* last = HJson_lastChild(container);
+    if (!last) {
         container->child = item;
     } else {
-        while (child->next) {
-            child = child->next;
+        last->next = item;
+    }
+    container->tail = HJson_chainEnd(item);
+}
+
+/* @brief Append items in order, linking them in one pass
+ * @param container Array or object
+ * @param items Items to append, null entries are skipped
+ * @param count Number of items
+ */
+static inline void HJson_addItems(HJson* container, HJson* const* items, int count) {
+    HJson* last = HJson_lastChild(container);
+    for (int i = 0; i < count; ++i) {
+        if (!items[i]) {
+            continue;
         }
-        child->next = item;
+        if (!last) {
+            container->child = items[i];
+        } else {
+            last->next = items[i];
+        }
+        last = HJson_chainEnd(items[i]);
     }
+    container->tail = last;
 }
 
-static void HJson_addItemToObject(HJson* container, const char* key, HJson* item) {
+static inline void HJson_addItemToObject(HJson* container, const char* key, HJson* item) {
     if (!item) {
         return;
     }
-    if (item->key) {
+    if (item->key && !(item->flags & HJSON_FLAG_CONST_KEY)) {
         free(item->key);
     }
     item->key = strdup(key);
+    item->key_hash = HJson_hashKey(key, strlen(key));
+    item->flags &= ~HJSON_FLAG_CONST_KEY;
+    HJson_addItem(container, item);
+}
+
+// Key is not copied, it must outlive item, e.g. a string literal
+static inline void HJson_addItemToObjectCS(HJson* container, const char* key, HJson* item) {
+    if (!item) {
+        return;
+    }
+    if (item->key && !(item->flags & HJSON_FLAG_CONST_KEY)) {
+        free(item->key);
+    }
+    item->key = const_cast<char*>(key);
+    item->key_hash = HJson_hashKey(key, strlen(key));
+    item->flags |= HJSON_FLAG_CONST_KEY;
     HJson_addItem(container, item);
-}
\ No newline at end of file
+}
+
+/* @brief Find member of object by key. A linear scan of the members,
+ *        their stored key hashes make each miss one integer compare.
+ *        There is no index, a lookup still costs O(members).
+ * @param object Object node
+ * @param key NUL-terminated key
+ * @return First member with that key, 0 if none
+ */
+static inline HJson* HJson_getObjectItem(HJson* object, const char* key) {
+    if (!object || object->type != ValueType::kObject || !key) {
+        return 0;
+    }
+    int len = strlen(key);
+    unsigned int hash = HJson_hashKey(key, len);
+    for (HJson* child = object->child; child; child = child->next) {
+        if (child->key_hash == hash && child->key
+            && !memcmp(child->key, key, len + 1)) {
+            return child;
+        }
+    }
+    return 0;
+}
+
+#endif // HJSON_HPP
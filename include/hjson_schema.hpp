@@ -0,0 +1,292 @@
+#ifndef HJSON_SCHEMA_HPP
+#define HJSON_SCHEMA_HPP
+
+#include <climits>
+#include <string>
+#include <vector>
+#include "hjson.hpp"
+
+/* Compile-time binding between a struct and its json object form.
+ *
+ * A struct declares its layout once:
+ *
+ *   template <> struct HJsonSchema<Task> {
+ *       HJSON_FIELD(Task, id);
+ *       HJSON_FIELD(Task, status);
+ *       typedef HJsonFields<id_field, status_field> fields;
+ *   };
+ *
+ * HJson_writeRecord then writes straight from struct fields into a
+ * HJson_buffer and HJson_readRecords fills structs from parse events. Key
+ * dispatch is unrolled per field by the compiler, no tree or lookup table
+ * is involved.
+ */
+
+// Conversion between a field type and json values, specialize for new types
+template <typename T>
+struct HJsonCodec;
+
+template <>
+struct HJsonCodec<std::string> {
+    static void write(HJson_buffer* buf, const std::string& v) {
+        HJson_writeQuotedLen(buf, v.data(), v.size());
+    }
+    static bool fromString(std::string& v, const char* str, int len) {
+        v.assign(str, len);
+        return true;
+    }
+    static bool fromNumber(std::string& /*v*/, double /*dv*/, int /*biv*/) {
+        return false;
+    }
+};
+
+template <>
+struct HJsonCodec<int> {
+    static void write(HJson_buffer* buf, int v) {
+        char* out = HJson_avoid(buf, 24);
+        if (out) {
+            buf->offset += HJson_writeInt64(out, v);
+        }
+    }
+    static bool fromString(int& /*v*/, const char* /*str*/, int /*len*/) {
+        return false;
+    }
+    // Fractions and values outside int are not an int, biv would only be
+    // their truncated or saturated form
+    static bool fromNumber(int& v, double dv, int /*biv*/) {
+        if (dv < INT_MIN || dv > INT_MAX || dv != (int)dv) {
+            return false;
+        }
+        v = (int)dv;
+        return true;
+    }
+};
+
+// Member of Owner bound to the json key Tag::key()
+template <typename Owner, typename T, T Owner::*Member, typename Codec = HJsonCodec<T> >
+struct HJsonMember {
+    typedef T type;
+    typedef Codec codec;
+    static T& get(Owner& o) { return o.*Member; }
+    static const T& get(const Owner& o) { return o.*Member; }
+};
+
+// Declares <member>_field, keyed by the member name. key() is the plain
+// key and tag() the quoted key with separator the writer emits as is.
+#define HJSON_FIELD_CODEC(Owner, member, Codec)                                         \
+    struct member##_field : HJsonMember<Owner, decltype(Owner::member), &Owner::member, \
+                                        Codec> {                                       \
+        static const char* key() { return #member; }                                   \
+        static const char* tag() { return "\"" #member "\":"; }                        \
+        enum { key_len = sizeof(#member) - 1, tag_len = sizeof(#member) + 2 };         \
+    }
+
+#define HJSON_FIELD(Owner, member) \
+    HJSON_FIELD_CODEC(Owner, member, HJsonCodec<decltype(Owner::member)>)
+
+template <typename Owner>
+struct HJsonSchema;
+
+template <typename... F>
+struct HJsonFields;
+
+template <>
+struct HJsonFields<> {
+    template <typename Owner>
+    static void write(HJson_buffer* /*buf*/, const Owner& /*o*/) {}
+    static int find(const char* /*str*/, int /*len*/, int /*index*/ = 0) {
+        return -1;
+    }
+    template <typename Owner>
+    static bool fromString(Owner& /*o*/, int /*index*/, const char* /*str*/, int /*len*/) {
+        return false;
+    }
+    template <typename Owner>
+    static bool fromNumber(Owner& /*o*/, int /*index*/, double /*dv*/, int /*biv*/) {
+        return false;
+    }
+};
+
+template <typename F, typename... Rest>
+struct HJsonFields<F, Rest...> {
+    // Members after the first, each preceded by a comma
+    template <typename Owner>
+    static void write(HJson_buffer* buf, const Owner& o) {
+        HJson_append(buf, F::tag(), F::tag_len);
+        F::codec::write(buf, F::get(o));
+        if (sizeof...(Rest)) {
+            HJson_putc(buf, ',');
+        }
+        HJsonFields<Rest...>::write(buf, o);
+    }
+    // Field index of key, -1 if not part of the schema
+    static int find(const char* str, int len, int index = 0) {
+        if (len == F::key_len && !memcmp(str, F::key(), len)) {
+            return index;
+        }
+        return HJsonFields<Rest...>::find(str, len, index + 1);
+    }
+    template <typename Owner>
+    static bool fromString(Owner& o, int index, const char* str, int len) {
+        if (index == 0) {
+            return F::codec::fromString(F::get(o), str, len);
+        }
+        return HJsonFields<Rest...>::fromString(o, index - 1, str, len);
+    }
+    template <typename Owner>
+    static bool fromNumber(Owner& o, int index, double dv, int biv) {
+        if (index == 0) {
+            return F::codec::fromNumber(F::get(o), dv, biv);
+        }
+        return HJsonFields<Rest...>::fromNumber(o, index - 1, dv, biv);
+    }
+};
+
+// Write o as one json object
+template <typename Owner>
+static void HJson_writeRecord(HJson_buffer* buf, const Owner& o) {
+    HJson_putc(buf, '{');
+    HJsonSchema<Owner>::fields::write(buf, o);
+    HJson_putc(buf, '}');
+}
+
+/* Fills records from parse events. Records are objects at record_depth,
+ * members outside the schema and anything nested deeper are ignored. A
+ * schema member whose value its codec does not accept fails the read,
+ * the record is never delivered with that field left at its default.
+ */
+template <typename Owner>
+struct HJson_recordReader {
+    typedef typename HJsonSchema<Owner>::fields fields;
+    // Called with every completed record, return false to stop
+    bool (*on_record)(void* ctx, Owner& record);
+    // Optional, decides whether a completed record reaches on_record
+    bool (*keep)(void* ctx, const Owner& record);
+    void* ctx;
+    int record_depth;
+    int depth;
+    int field;
+    // String field keep must not look at, its text waits in held_text and
+    // is decoded only into records keep accepts. -1 if none.
+    int held;
+    std::string held_text;
+    Owner current;
+
+    static bool onStart(void* p) {
+        HJson_recordReader* r = static_cast<HJson_recordReader*>(p);
+        // No codec takes an object or array
+        if (r->field >= 0) {
+            return false;
+        }
+        if (++r->depth == r->record_depth) {
+            r->current = Owner();
+            r->held_text.clear();
+        }
+        r->field = -1;
+        return true;
+    }
+    static bool onEnd(void* p) {
+        HJson_recordReader* r = static_cast<HJson_recordReader*>(p);
+        r->field = -1;
+        if (r->depth-- == r->record_depth) {
+            if (r->keep && !r->keep(r->ctx, r->current)) {
+                return true;
+            }
+            if (r->held >= 0 && !r->held_text.empty()
+                && !fields::fromString(r->current, r->held, r->held_text.data(), r->held_text.size())) {
+                return false;
+            }
+            return r->on_record(r->ctx, r->current);
+        }
+        return true;
+    }
+    static bool onKey(void* p, const char* str, int len) {
+        HJson_recordReader* r = static_cast<HJson_recordReader*>(p);
+        r->field = r->depth == r->record_depth ? fields::find(str, len) : -1;
+        return true;
+    }
+    static bool onString(void* p, const char* str, int len) {
+        HJson_recordReader* r = static_cast<HJson_recordReader*>(p);
+        if (r->field >= 0 && r->field == r->held) {
+            // Reuses the capacity of earlier records, no allocation per record
+            r->held_text.assign(str, len);
+            return true;
+        }
+        return r->field < 0 || fields::fromString(r->current, r->field, str, len);
+    }
+    static bool onNumber(void* p, double dv, int biv) {
+        HJson_recordReader* r = static_cast<HJson_recordReader*>(p);
+        return r->field < 0 || fields::fromNumber(r->current, r->field, dv, biv);
+    }
+    static bool onBoolean(void* p, bool /*v*/) {
+        return static_cast<HJson_recordReader*>(p)->field < 0;
+    }
+    static bool onNull(void* p) {
+        return static_cast<HJson_recordReader*>(p)->field < 0;
+    }
+    static const HJson_handler* handler() {
+        static const HJson_handler h = {
+            onStart, onEnd, onStart, onEnd, onKey, onString, onNumber, onBoolean, onNull
+        };
+        return &h;
+    }
+};
+
+template <typename Owner>
+static bool HJson_readRecords(const char* value, HJson_recordReader<Owner>* reader) {
+    reader->depth = 0;
+    reader->field = -1;
+    return HJson_parseEvents(value, HJson_recordReader<Owner>::handler(), reader);
+}
+
+/* @brief Read records from json text
+ * @param value NUL-terminated text, an array of objects, or a single
+ *              object when record_depth is 1
+ * @param on_record Receives each record, may move from it
+ * @param ctx Passed to on_record
+ * @param record_depth Nesting depth of record objects
+ * @return true if the text parsed and on_record never stopped it
+ */
+template <typename Owner>
+static bool HJson_readRecords(const char* value, bool (*on_record)(void*, Owner&),
+                              void* ctx, int record_depth = 2) {
+    HJson_recordReader<Owner> reader;
+    reader.on_record = on_record;
+    reader.keep = 0;
+    reader.ctx = ctx;
+    reader.record_depth = record_depth;
+    reader.held = -1;
+    return HJson_readRecords(value, &reader);
+}
+
+/* @brief Read only the records keep accepts from an array of records
+ * @param keep Sees each record without the held_key field
+ * @param held_key String field decoded only for records keep accepts,
+ *                 rejected records never allocate it
+ */
+template <typename Owner>
+static bool HJson_readRecords(const char* value, bool (*on_record)(void*, Owner&), void* ctx,
+                              bool (*keep)(void*, const Owner&), const char* held_key) {
+    typedef typename HJsonSchema<Owner>::fields fields;
+    HJson_recordReader<Owner> reader;
+    reader.on_record = on_record;
+    reader.keep = keep;
+    reader.ctx = ctx;
+    reader.record_depth = 2;
+    reader.held = fields::find(held_key, strlen(held_key));
+    return HJson_readRecords(value, &reader);
+}
+
+template <typename Owner>
+static bool HJson_collectRecord(void* ctx, Owner& record) {
+    static_cast<std::vector<Owner>*>(ctx)->push_back(std::move(record));
+    return true;
+}
+
+// Read an array of records into out
+template <typename Owner>
+static bool HJson_readRecords(const char* value, std::vector<Owner>& out) {
+    return HJson_readRecords<Owner>(value, HJson_collectRecord<Owner>, &out);
+}
+
+#endif // HJSON_SCHEMA_HPP
@@ -0,0 +1,43 @@
+#ifndef ID_SET_HPP
+#define ID_SET_HPP
+
+#include "helper.hpp"
+
+// Set of task ids as a bitset, one bit per id up to the highest id set
+class IdSet {
+public:
+    void Set(TaskId id) {
+        size_t w = id / 64;
+        if (w >= bits_.size()) {
+            bits_.resize(w + 1, 0);
+        }
+        bits_[w] |= 1ull << (id % 64);
+    }
+
+    void Clear(TaskId id) {
+        size_t w = id / 64;
+        if (w < bits_.size()) {
+            bits_[w] &= ~(1ull << (id % 64));
+        }
+    }
+
+    bool Test(TaskId id) const {
+        size_t w = id / 64;
+        return w < bits_.size() && (bits_[w] >> (id % 64) & 1);
+    }
+
+    // Call fn with every id in ascending order, skipping empty words
+    template <typename Fn>
+    void ForEach(Fn fn) const {
+        for (size_t w = 0; w < bits_.size(); ++w) {
+            for (uint64_t word = bits_[w]; word; word &= word - 1) {
+                fn(static_cast<TaskId>(w * 64 + __builtin_ctzll(word)));
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> bits_;
+};
+
+#endif // ID_SET_HPP
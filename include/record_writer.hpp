@@ -0,0 +1,48 @@
+#ifndef RECORD_WRITER_HPP
+#define RECORD_WRITER_HPP
+
+#include "helper.hpp"
+#include <cstdio>
+
+struct HJson_buffer;
+
+// Output formats of list, the table is for people, the rest for tools
+enum class ListFormat {
+    kTable,
+    kNdjson,
+    kCsv,
+    kJson
+};
+
+// Format named table, ndjson, csv or json, false for anything else
+bool ParseListFormat(const std::string& name, ListFormat* format);
+
+// Streams tasks in one of the machine readable formats. Each row is
+// appended straight from the struct fields, json through the Task schema,
+// and full chunks are handed to out as they fill, so a reader at the
+// other end of a pipe sees the first rows long before the last.
+class RecordWriter {
+public:
+    RecordWriter(FILE* out, ListFormat format);
+    ~RecordWriter();
+
+    void Row(const Task& t);
+
+    // Close the document, flush and stop taking rows
+    void Finish();
+
+private:
+    void csvField(const std::string& v);
+
+    // Hand the buffer over once it holds a full chunk
+    void spill(bool force);
+
+    FILE* out_;
+    ListFormat format_;
+    // Owned, kept behind a pointer so hjson.hpp stays out of this header
+    HJson_buffer* buf_;
+    size_t rows_;
+    bool finished_;
+};
+
+#endif // RECORD_WRITER_HPP
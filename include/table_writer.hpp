@@ -0,0 +1,40 @@
+#ifndef TABLE_WRITER_HPP
+#define TABLE_WRITER_HPP
+
+#include "helper.hpp"
+#include <cstdio>
+
+// Renders tasks as the list table:
+//
+// +------+-------------+--------+---------------------+---------------------+
+// |  id  | description | status |    created_time     |    updated_time     |
+//
+// Column widths come from one pass over the rows. Everything is formatted
+// into one buffer that goes out in a few large writes instead of several
+// stdio calls per row.
+class TableWriter {
+public:
+    explicit TableWriter(FILE* out);
+    ~TableWriter();
+
+    // Format rows with a head, output may still be buffered until Flush
+    void Render(const std::vector<const Task*>& rows);
+
+    void Flush();
+
+private:
+    enum { kColumns = 5 };
+
+    void rule();
+
+    void cell(int column, const char* text, size_t len);
+
+    // Hand the buffer over once it holds a full chunk
+    void spill();
+
+    FILE* out_;
+    std::string buf_;
+    size_t widths_[kColumns];
+};
+
+#endif // TABLE_WRITER_HPP
@@ -0,0 +1,47 @@
+#ifndef TASK_CLIENT_HPP
+#define TASK_CLIENT_HPP
+
+#include "helper.hpp"
+
+/* Wire format between the CLI and a serving process, one frame each way
+ * per command, any number of commands per connection:
+ *
+ *   request  u32 length | varint word count | words | input
+ *   reply    u32 length | varint rc | out | err
+ *
+ * words, input, out and err are length-prefixed bytes. words is the
+ * command and its arguments, input the text a batch reads.
+ */
+struct ServeRequest {
+    std::vector<std::string> words;
+    std::string input;
+};
+
+struct ServeReply {
+    int rc;
+    std::string out;
+    std::string err;
+};
+
+// Frame length prefix
+const size_t kServeFrameHeader = 4;
+// Frames above this are refused, guards against garbage lengths
+const size_t kServeMaxFrame = 64 * 1024 * 1024;
+
+void EncodeRequest(std::string& out, const ServeRequest& req);
+
+bool DecodeRequest(const char* p, const char* end, ServeRequest* req);
+
+void EncodeReply(std::string& out, const ServeReply& reply);
+
+bool DecodeReply(const char* p, const char* end, ServeReply* reply);
+
+// Connect to the serving process at path, -1 if none is listening
+int ServeConnect(const std::string& path);
+
+/* @brief Send one request over fd and wait for its reply
+ * @return false if the connection failed or the reply is malformed
+ */
+bool ServeCall(int fd, const ServeRequest& req, ServeReply* reply);
+
+#endif // TASK_CLIENT_HPP
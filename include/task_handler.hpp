@@ -1,8 +1,21 @@
 #ifndef TASK_HANDLER_HPP
 #define TASK_HANDLER_HPP
 
+#include "file_lock.hpp"
 #include "helper.hpp"
+#include "task_log.hpp"
+#include "task_storage.hpp"
+#include "task_table.hpp"
+#include "text_index.hpp"
+#include <memory>
 
+// What list shows, see task_handler.cc
+struct ListQuery;
+
+// Processes share a store through a lock file: reads run under a shared
+// lock, changes under an exclusive one. Tasks are loaded under the shared
+// lock and checked against the files again once the exclusive lock is
+// held, a store changed in between is reloaded before the command runs.
 class TaskHandler {
 public:
     TaskHandler();
@@ -15,12 +28,84 @@ public:
      */
     int Handle(const std::string& /*cmd*/, const std::vector<std::string>& /*args*/);
 
+    /* @brief Run one command per line of in, see handleBatch
+     * @return 0 if every line succeeded
+     */
+    int Batch(std::istream& /*in*/);
+
+    // Load every task unless that happened already. These return false
+    // with the message in ErrLast, a serving process keeps running.
+    bool Load();
+
+    // Log and sync changes made so far, also done on destruction. On
+    // failure the changes are dropped and tasks are read again next time.
+    bool Commit();
+
+    // Commit, then fold any log into a fresh snapshot
+    bool Compact();
+
+    // Commit and let other processes at the store, the log is synced once
+    // the lock is released. Loaded tasks are kept, the next command
+    // reloads them if the store changed meanwhile.
+    bool Unlock();
+
+    // Where command output and batch errors go, stdout and stderr by default
+    void SetOutput(FILE* out, FILE* err) {
+        out_ = out;
+        err_ = err;
+    }
+
+    // Changes were made since the last Commit
+    bool HasChanges() const { return updated_; }
+
+    // Socket a serving process listens on for the configured storage
+    static std::string SocketPath();
+
 private:
 
-    void init();
+    // Hold the store lock in mode, LOCK_SH or LOCK_EX, an exclusive lock
+    // covers both. Drops loaded tasks another process made stale.
+    bool lock(int /*mode*/);
+
+    // Make sure tasks are loaded, only the task with id if point is set
+    bool load(bool /*point*/, TaskId /*id*/);
+
+    void unload();
+
+    void dropUncommitted();
+
+    bool putAll(std::vector<Task>& /*tasks*/);
+
+    void warnUnknownTimes(size_t /*before*/);
+
+    bool init();
+
+    bool initSome(std::vector<TaskId> /*ids*/, bool /*logged*/);
 
-    void flush();
+    bool initFiltered(const ListQuery& /*q*/);
+
+    // Stamps of snapshot and log, see FileStamp
+    void stampStore(FileStamp* /*snapshot*/, FileStamp* /*log*/) const;
+
+    // Store files still look like they did when tasks were loaded
+    bool storeUnchanged() const;
+
+    bool flush();
+
+    // Apply a replayed log record to task_table_
+    void applyRecord(const LogRecord& /*r*/);
+
+    // Append pending records to the log, compact when it grew too large
+    bool commit();
+
+    // Force committed records to disk
+    bool sync();
+
+    // Snapshot all tasks and drop the log
+    bool compact();
     
+    Task* findTask(const std::string& /*arg*/);
+
     int handleAddTask(const std::string& /*arg*/);
 
     int handleUpdateTask(const std::vector<std::string>& /*args*/);
@@ -31,16 +116,52 @@ private:
 
     int handleListTask(const std::vector<std::string>& /*args*/);
 
-    void printTask(TaskStatus /*status*/);
+    int handleSearch(const std::vector<std::string>& /*args*/);
+
+    bool searchSaved(const SearchQuery& /*query*/, Postings* /*ids*/, bool* /*found*/);
+
+    void buildTextIndex();
+
+    // Save the search index next to the snapshot, built first if need be
+    void saveTextIndex();
+
+    // Move id from the terms of before to those of after in a resident
+    // search index
+    void reindex(TaskId /*id*/, const std::string& /*before*/, const std::string& /*after*/);
+
+    std::string termsPath() const { return storage_->Path() + kTaskTermsSuffix; }
+
+    int handleConvert(const std::string& /*arg*/);
+
+    int handleBatch(const std::vector<std::string>& /*args*/);
+
+    // Every cached task in id order
+    TaskRefs allTasks() const;
+
+    void printTask(const ListQuery& /*q*/, const TaskRefs* /*only*/ = 0);
 
 private:
-    std::map<std::string, Task> task_cache_;
-    std::vector<Task> task_all_;
-    std::vector<Task> task_todo_;
-    std::vector<Task> task_progress_;
-    std::vector<Task> task_done_;
-    int latest_id_;
+    // Sole owner of loaded tasks, indexed by id and status
+    TaskTable task_table_;
     bool updated_;
+    std::unique_ptr<TaskStorage> storage_;
+    TaskLog log_;
+    // Bytes of snapshot at load
+    size_t snapshot_size_;
+    // Ids whose snapshot record is outdated
+    IdSet dirty_;
+    // Search index over every loaded task once a search built it, kept up
+    // to date by each change from then on
+    std::unique_ptr<TextIndex> text_index_;
+    bool loaded_;
+    // Only the task of a point command is loaded
+    bool partial_;
+    FILE* out_;
+    FILE* err_;
+    FileLock lock_;
+    // Store files as of the loaded tasks
+    FileStamp snapshot_stamp_;
+    FileStamp log_stamp_;
 };
 
 #endif // TASK_HANDLER_HPP
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef TASK_LOG_HPP
+#define TASK_LOG_HPP
+
+#include "helper.hpp"
+
+enum class LogOp : uint8_t {
+    kAdd = 1,
+    kUpdate,
+    kMark,
+    kDelete
+};
+
+// One mutation, only the fields the op touches are meaningful
+struct LogRecord {
+    LogOp op;
+    Task task;
+};
+
+// When committed records are forced to disk
+struct CommitPolicy {
+    // Wait before each sync so writers in other processes can append and
+    // share it, 0 syncs right away. Only useful while no lock keeps them
+    // out, TaskHandler::Unlock syncs after releasing it.
+    int delay_us;
+};
+
+// Append-only mutation log kept next to the json snapshot. Each record is
+// framed as [u32 payload length][u32 crc32][payload] so a torn tail left by
+// a crash is detected and dropped on replay.
+class TaskLog {
+public:
+    TaskLog(const char* path, const CommitPolicy& policy);
+    ~TaskLog();
+
+    /* @brief Read every intact record, a torn tail is cut off the file
+     * @param records Output, in append order
+     * @return false if the log exists but could not be read
+     */
+    bool Replay(std::vector<LogRecord>& records);
+
+    /* @brief Queue a record, nothing hits the disk before Commit
+     * @param op
+     * @param t Task the op applies to
+     */
+    void Append(LogOp op, const Task& t);
+
+    // Write all queued records with one append, Sync makes them durable
+    bool Commit();
+
+    // Force every committed record to disk
+    bool Sync();
+
+    // Drop the log once its records are folded into the snapshot
+    bool Reset();
+
+    // Let go of the open file, another process may have replaced the log.
+    // Committed records stay, the next Replay picks up from the file.
+    void Close();
+
+    bool HasPending() const { return !pending_.empty(); }
+
+    // Committed bytes on disk
+    size_t Size() const { return size_; }
+
+private:
+    std::string path_;
+    CommitPolicy policy_;
+    std::string pending_;
+    size_t pending_records_;
+    // Records written since the last sync
+    size_t unsynced_;
+    size_t size_;
+    int fd_;
+    // The log file was created by us, its directory entry needs a sync
+    bool created_;
+};
+
+#endif // TASK_LOG_HPP
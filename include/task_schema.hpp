@@ -0,0 +1,75 @@
+#ifndef TASK_SCHEMA_HPP
+#define TASK_SCHEMA_HPP
+
+#include "helper.hpp"
+#include "hjson_schema.hpp"
+#include "task_time.hpp"
+
+// Ids are integers in memory but stay quoted decimal strings on disk, the
+// layout task.json has always had. Bare numbers are accepted on read.
+struct TaskIdCodec {
+    static void write(HJson_buffer* buf, TaskId v) {
+        char* out = HJson_avoid(buf, 16);
+        if (out) {
+            out[0] = '"';
+            int len = HJson_writeInt64(out + 1, v);
+            out[len + 1] = '"';
+            buf->offset += len + 2;
+        }
+    }
+    static bool fromString(TaskId& v, const char* str, int len) {
+        return ParseTaskId(str, len, &v);
+    }
+    static bool fromNumber(TaskId& v, double dv, int /*biv*/) {
+        if (dv < 1 || dv > kMaxTaskId || dv != (TaskId)dv) {
+            return false;
+        }
+        v = (TaskId)dv;
+        return true;
+    }
+};
+
+// Times are integers in memory and "%Y-%m-%d %T" text on disk, as
+// task.json has always had them. Bare numbers are accepted on read. Text
+// older versions wrote that does not parse reads as kUnknownTaskTime.
+struct TaskTimeCodec {
+    static void write(HJson_buffer* buf, TaskTime v) {
+        char* out = HJson_avoid(buf, kTaskTimeLen + 2);
+        if (out) {
+            out[0] = '"';
+            FormatTaskTime(v, out + 1);
+            out[kTaskTimeLen + 1] = '"';
+            buf->offset += kTaskTimeLen + 2;
+        }
+    }
+    static bool fromString(TaskTime& v, const char* str, int len) {
+        v = ReadStoredTaskTime(str, len);
+        return true;
+    }
+    static bool fromNumber(TaskTime& v, double dv, int /*biv*/) {
+        if (dv < kMinTaskTime || dv > kMaxTaskTime || dv != (TaskTime)dv) {
+            return false;
+        }
+        v = (TaskTime)dv;
+        return true;
+    }
+};
+
+// Json layout of Task, the only place its keys are spelled out
+template <>
+struct HJsonSchema<Task> {
+    HJSON_FIELD_CODEC(Task, id, TaskIdCodec);
+    HJSON_FIELD(Task, description);
+    HJSON_FIELD(Task, status);
+    HJSON_FIELD_CODEC(Task, created_at, TaskTimeCodec);
+    HJSON_FIELD_CODEC(Task, updated_at, TaskTimeCodec);
+    typedef HJsonFields<
+        id_field,
+        description_field,
+        status_field,
+        created_at_field,
+        updated_at_field
+    > fields;
+};
+
+#endif // TASK_SCHEMA_HPP
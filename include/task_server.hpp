@@ -0,0 +1,72 @@
+#ifndef TASK_SERVER_HPP
+#define TASK_SERVER_HPP
+
+#include "task_handler.hpp"
+#include "task_client.hpp"
+
+// Keeps one TaskHandler loaded and runs commands for CLI clients over a
+// Unix socket, see task_client.hpp for the wire format. All clients are
+// served from a single epoll loop.
+//
+// Every command handled in one wakeup is committed with one log write and
+// one sync before any of their replies go out, so a reply still means the
+// change is on disk while concurrent clients share the sync. After
+// kServeIdleMs without traffic the log is folded into the snapshot. The
+// store lock is only held while a wakeup is handled, so commands run with
+// TTC_NO_SERVE=1 still get at the store in between. A command that fails,
+// a broken store or a failed commit included, only fails its own reply.
+class TaskServer {
+public:
+    explicit TaskServer(TaskHandler* handler);
+    ~TaskServer();
+
+    /* @brief Serve until SIGINT or SIGTERM
+     * @param path Socket to listen on, replaced if stale
+     * @return Process exit code
+     */
+    int Run(const std::string& path);
+
+private:
+    struct Held {
+        ServeReply reply;
+        bool changed;
+    };
+
+    struct Client {
+        int fd;
+        std::string in;
+        std::string out;
+        // Replies waiting for the commit of this wakeup
+        std::vector<Held> held;
+    };
+
+    bool listen(const std::string& path);
+
+    void accept();
+
+    // Read what fd has and run every complete request, false on hangup
+    bool readClient(Client* c);
+
+    // Push out as much of c->out as the socket takes, false on error
+    bool writeClient(Client* c);
+
+    void closeClient(Client* c);
+
+    void execute(const ServeRequest& req, ServeReply* reply);
+
+    // Commit changes of this wakeup, then release held replies
+    void release();
+
+    void watch(Client* c);
+
+    TaskHandler* handler_;
+    int epoll_fd_;
+    int listen_fd_;
+    int signal_fd_;
+    std::string path_;
+    std::map<int, Client> clients_;
+    // Compact once traffic stops
+    bool idle_pending_;
+};
+
+#endif // TASK_SERVER_HPP
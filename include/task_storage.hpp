@@ -0,0 +1,120 @@
+#ifndef TASK_STORAGE_HPP
+#define TASK_STORAGE_HPP
+
+#include "helper.hpp"
+#include "id_set.hpp"
+#include <functional>
+
+// Tasks handed to a backend for saving, in output order
+typedef std::vector<const Task*> TaskRefs;
+
+// Decides during a load whether a task is kept. It must not look at the
+// description, backends may read that only for tasks it keeps.
+typedef std::function<bool(const Task&)> TaskKeep;
+
+enum class StorageKind {
+    kJson,
+    kBinary
+};
+
+// Snapshot persistence of the whole task list
+class TaskStorage {
+public:
+    virtual ~TaskStorage() {}
+
+    /* @brief Load every task, a missing or empty store loads as no tasks
+     * @param tasks Output
+     * @param bytes Size of the stored snapshot
+     * @param keep Only tasks it accepts are loaded, all if empty
+     * @return false if the store exists but is unreadable or malformed
+     */
+    virtual bool Load(std::vector<Task>& tasks, size_t* bytes, const TaskKeep& keep = TaskKeep()) = 0;
+
+    /* @brief Load the tasks with ids alone, without reading the others
+     * @param ids Any order, ids the snapshot lacks are skipped
+     * @param tasks Output, the tasks found
+     * @param bytes Size of the stored snapshot
+     * @return false if the backend cannot answer this without a full Load
+     */
+    virtual bool LoadSome(const std::vector<TaskId>& /*ids*/, std::vector<Task>& /*tasks*/,
+                          size_t* /*bytes*/) {
+        return false;
+    }
+
+    /* @brief Replace the stored snapshot with tasks, atomically and durably
+     * @param dirty Ids changed since the snapshot was loaded, 0 if unknown.
+     *        Backends may copy every other task from the current snapshot.
+     * @return false on any write error, the old snapshot is kept then
+     */
+    virtual bool Save(const TaskRefs& tasks, const IdSet* dirty = 0) = 0;
+
+    const std::string& Path() const { return path_; }
+
+protected:
+    explicit TaskStorage(const std::string& path): path_(path) {}
+
+    std::string path_;
+};
+
+// Byte range of one record inside a json snapshot
+struct JsonIndexEntry {
+    TaskId id;
+    uint32_t length;
+    uint64_t offset;
+};
+
+/* Json array of task objects, see task_schema.hpp. Every save also writes
+ * a sidecar index of where each record sits in the file:
+ *
+ *   header   "TTCI" | u32 version | u64 json size | u64 json mtime sec
+ *            | u64 json mtime nsec | u32 count | u32 reserved
+ *   entries  u32 id | u32 length | u64 offset, ascending by id
+ *
+ * The index is trusted only while size and mtime still match the json
+ * file, so a hand edit simply turns it off.
+ */
+class JsonStorage : public TaskStorage {
+public:
+    explicit JsonStorage(const std::string& path): TaskStorage(path) {}
+
+    bool Load(std::vector<Task>& tasks, size_t* bytes, const TaskKeep& keep = TaskKeep()) override;
+
+    bool LoadSome(const std::vector<TaskId>& ids, std::vector<Task>& tasks, size_t* bytes) override;
+
+    bool Save(const TaskRefs& tasks, const IdSet* dirty = 0) override;
+
+    // Stream tasks as a json array to fd
+    static bool Write(int fd, const TaskRefs& tasks);
+
+private:
+    std::string indexPath() const { return path_ + kTaskIndexSuffix; }
+};
+
+/* Versioned binary snapshot, all integers little endian:
+ *
+ *   header   "TTCB" | u32 version | u32 count | u32 crc32(records + heap)
+ *            | u64 records size | u64 heap size
+ *   records  per task: varint id | varint status | u8 flags
+ *            | varint created | varint updated | varint description offset
+ *   heap     length-prefixed strings, addressed by byte offset
+ *
+ * Timestamps are stored as seconds of their "%Y-%m-%d %T" wall clock
+ * reading. Flagged ones are heap text instead: times before 1970, and in
+ * older snapshots timestamps that did not parse.
+ */
+class BinaryStorage : public TaskStorage {
+public:
+    explicit BinaryStorage(const std::string& path): TaskStorage(path) {}
+
+    bool Load(std::vector<Task>& tasks, size_t* bytes, const TaskKeep& keep = TaskKeep()) override;
+
+    bool Save(const TaskRefs& tasks, const IdSet* dirty = 0) override;
+};
+
+// Backend for kind, caller owns it
+TaskStorage* CreateStorage(StorageKind /*kind*/, const std::string& /*path*/);
+
+// Backend chosen by file extension, ".json" or binary otherwise
+TaskStorage* CreateStorage(const std::string& /*path*/);
+
+#endif // TASK_STORAGE_HPP
@@ -0,0 +1,82 @@
+#ifndef TASK_TABLE_HPP
+#define TASK_TABLE_HPP
+
+#include "helper.hpp"
+#include "id_set.hpp"
+
+// Tasks keyed by integer id. Tasks are packed in one vector and a dense
+// id-indexed slot array finds them, so lookup is two array reads and
+// walking the slot array visits tasks in numeric id order. Each known
+// status also keeps a bitset of its ids, updated on every change, so
+// listing one status skips everything else 64 ids at a time.
+class TaskTable {
+public:
+    TaskTable(): next_id_(1) {}
+
+    // Task with id, 0 if there is none. Change status through SetStatus
+    // only, the status index would go stale otherwise.
+    Task* Find(TaskId id);
+
+    void SetStatus(Task* t, int status);
+
+    /* @brief Store t under t.id, replacing any task with that id
+     * @return false if t.id is 0 or above kMaxTaskId
+     */
+    bool Put(const Task& t);
+    bool Put(Task&& t);
+
+    // Remove the task with id, false if there was none. Ids up to id are
+    // not handed out again either way.
+    bool Erase(TaskId id);
+
+    // Id for the next new task, never one a current task holds
+    TaskId NextId() const { return next_id_; }
+
+    size_t Size() const { return tasks_.size(); }
+
+    // Call fn with every task in ascending id order
+    template <typename Fn>
+    void ForEach(Fn fn) const {
+        for (size_t id = 1; id < slots_.size(); ++id) {
+            if (slots_[id]) {
+                fn(tasks_[slots_[id] - 1]);
+            }
+        }
+    }
+
+    // Same for tasks with status only, kUnknown means every task
+    template <typename Fn>
+    void ForEach(TaskStatus status, Fn fn) const {
+        int i = statusIndex(static_cast<int>(status));
+        if (i < 0) {
+            ForEach(fn);
+            return;
+        }
+        status_ids_[i].ForEach([this, &fn](TaskId id) {
+            fn(tasks_[slots_[id] - 1]);
+        });
+    }
+
+private:
+    enum { kStatusCount = 3 };
+
+    // Bitset of a status, -1 for values outside TaskStatus
+    static int statusIndex(int status) {
+        return status >= 0 && status < kStatusCount ? status : -1;
+    }
+
+    // Slot of id, 0 if absent, otherwise index into tasks_ plus one
+    uint32_t* slot(TaskId id);
+
+    void index(TaskId id, int status, bool set);
+
+    std::vector<Task> tasks_;
+    std::vector<uint32_t> slots_;
+    // Ids per known status
+    IdSet status_ids_[kStatusCount];
+    // One above the highest id ever stored or erased, so ids of deleted
+    // tasks are not handed out again
+    TaskId next_id_;
+};
+
+#endif // TASK_TABLE_HPP
@@ -0,0 +1,55 @@
+#ifndef TASK_TIME_HPP
+#define TASK_TIME_HPP
+
+#include "helper.hpp"
+
+// A TaskTime counts seconds of the local wall clock, the zone is applied
+// once when a time is taken. "%Y-%m-%d %T" text maps to it and back with
+// plain arithmetic, and times order the way that text always did.
+
+// Length of "YYYY-MM-DD hh:mm:ss"
+const size_t kTaskTimeLen = 19;
+// 0000-01-01 00:00:00, the first time with a four digit year
+const TaskTime kMinTaskTime = -62167219200LL;
+// 9999-12-31 23:59:59, the last time with a four digit year
+const TaskTime kMaxTaskTime = 253402300799LL;
+// Read in place of a stored time that does not parse, so the task stays
+// loadable. Sorts before every real time and reads back as itself.
+const TaskTime kUnknownTaskTime = kMinTaskTime;
+
+/* @brief Read a "YYYY-MM-DD hh:mm:ss" reading, any four digit year
+ * @return false if malformed, out of range or not a calendar date
+ */
+bool ParseTaskTime(const char* str, size_t len, TaskTime* t);
+
+static inline bool ParseTaskTime(const std::string& str, TaskTime* t) {
+    return ParseTaskTime(str.data(), str.size(), t);
+}
+
+/* @brief ParseTaskTime for times read from a store, which older versions
+ *        wrote as free text. Text that does not parse reads as
+ *        kUnknownTaskTime and is counted in UnknownTaskTimes.
+ */
+TaskTime ReadStoredTaskTime(const char* str, size_t len);
+
+// Stored times read as kUnknownTaskTime so far by this process
+size_t UnknownTaskTimes();
+
+/* @brief Write t as "YYYY-MM-DD hh:mm:ss", the date part is cached so
+ *        runs of times from the same day only format the clock
+ * @param out At least kTaskTimeLen bytes, not terminated
+ */
+void FormatTaskTime(TaskTime t, char* out);
+
+static inline std::string FormatTaskTime(TaskTime t) {
+    char buf[kTaskTimeLen];
+    FormatTaskTime(t, buf);
+    return std::string(buf, kTaskTimeLen);
+}
+
+// Local wall clock now. The zone offset is looked up again only when the
+// clock leaves the quarter hour it was looked up in, offsets and their
+// changes all fall on quarter hours.
+TaskTime TaskTimeNow();
+
+#endif // TASK_TIME_HPP
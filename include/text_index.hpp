@@ -0,0 +1,117 @@
+#ifndef TEXT_INDEX_HPP
+#define TEXT_INDEX_HPP
+
+#include "helper.hpp"
+#include "file_map.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+typedef std::vector<TaskId> Postings;
+
+/* @brief Split text into distinct lowercase words, runs of ascii letters
+ *        and digits. Bytes above 0x7f count as letters, utf-8 words stay
+ *        whole.
+ * @param text
+ * @param terms Output, replaced, in order of first appearance
+ */
+void Tokenize(const std::string& text, std::vector<std::string>* terms);
+
+// Terms of a search, each group lists terms that must all match and a
+// task matches the query if any group matches
+typedef std::vector<std::vector<std::string>> SearchQuery;
+
+/* @brief Build a query from command words, words are tokenized like
+ *        descriptions and the word OR starts a new group
+ * @return false if some group ends up without terms
+ */
+bool ParseSearchQuery(const std::vector<std::string>& words, SearchQuery* query);
+
+// text holds every term of some group of query
+bool MatchesQuery(const SearchQuery& query, const std::string& text);
+
+// Ids in both a and b. Walks the shorter list and gallops through the
+// longer one, cost grows with the shorter list only.
+void IntersectPostings(const Postings& a, const Postings& b, Postings* out);
+
+// Ids in a or b
+void UnionPostings(const Postings& a, const Postings& b, Postings* out);
+
+/* @brief Evaluate query over posting lists, the rarest term of a group
+ *        is intersected first so intermediate lists only shrink
+ * @param find Called as find(term, Postings*), false if term is unknown
+ * @param out Output, ascending ids
+ */
+template <typename Find>
+void EvalQuery(const SearchQuery& query, Find find, Postings* out) {
+    out->clear();
+    Postings hits, tmp;
+    for (size_t g = 0; g < query.size(); ++g) {
+        std::vector<Postings> lists(query[g].size());
+        bool empty = false;
+        for (size_t i = 0; i < lists.size() && !empty; ++i) {
+            empty = !find(query[g][i], &lists[i]) || lists[i].empty();
+        }
+        if (empty) {
+            continue;
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](const Postings& a, const Postings& b) { return a.size() < b.size(); });
+        hits.swap(lists[0]);
+        for (size_t i = 1; i < lists.size() && !hits.empty(); ++i) {
+            IntersectPostings(hits, lists[i], &tmp);
+            hits.swap(tmp);
+        }
+        UnionPostings(*out, hits, &tmp);
+        out->swap(tmp);
+    }
+}
+
+// Inverted index from description terms to the ascending ids of tasks
+// whose description holds them. Kept up to date one task at a time.
+class TextIndex {
+public:
+    void Add(TaskId id, const std::string& text);
+
+    void Remove(TaskId id, const std::string& text);
+
+    // Ids of tasks with term, 0 if there are none
+    const Postings* Find(const std::string& term) const;
+
+    /* @brief Write the index to path, tagged with the snapshot it matches
+     * @param snapshot Stat of that snapshot, all zero if there is none
+     * @return false on any write error, path is left as it was then
+     */
+    bool Save(const std::string& path, const struct stat& snapshot) const;
+
+private:
+    std::unordered_map<std::string, Postings> postings_;
+};
+
+/* Saved TextIndex, all integers little endian:
+ *
+ *   header   "TTCT" | u32 version | u64 snapshot size
+ *            | u64 snapshot mtime sec | u64 snapshot mtime nsec
+ *            | u32 term count | u32 reserved
+ *   terms    u32 text offset | u32 text length | u32 postings offset
+ *            | u32 postings count, ascending by term text
+ *   text     term bytes
+ *   postings per term, first id then gaps to the previous one, varints
+ *
+ * Offsets count from the start of the file. A lookup binary searches the
+ * mapped term table and decodes that term's postings only. The file is
+ * trusted only while size and mtime still match the snapshot.
+ */
+struct TextIndexFile {
+    FileMap fm;
+    uint32_t count;
+};
+
+// Map path if it was written for snapshot, false otherwise
+bool TextIndexFileOpen(TextIndexFile* f, const std::string& path, const struct stat& snapshot);
+
+// Ids of tasks with term, false if the file does not know term
+bool TextIndexFileFind(const TextIndexFile* f, const std::string& term, Postings* ids);
+
+void TextIndexFileClose(TextIndexFile* f);
+
+#endif // TEXT_INDEX_HPP
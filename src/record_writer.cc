@@ -0,0 +1,111 @@
+#include "record_writer.hpp"
+#include "task_schema.hpp"
+
+static const int kRecordChunk = 64 * 1024;
+
+bool ParseListFormat(const std::string& name, ListFormat* format) {
+    static const std::unordered_map<std::string, ListFormat> formats = {
+        {"table", ListFormat::kTable},
+        {"ndjson", ListFormat::kNdjson},
+        {"csv", ListFormat::kCsv},
+        {"json", ListFormat::kJson}
+    };
+    auto iter = formats.find(name);
+    if (iter == formats.end()) {
+        return false;
+    }
+    *format = iter->second;
+    return true;
+}
+
+RecordWriter::RecordWriter(FILE* out, ListFormat format)
+    : out_(out)
+    , format_(format)
+    , buf_(new HJson_buffer())
+    , rows_(0)
+    , finished_(false) {
+    buf_->buffer = (char*)malloc(kRecordChunk + 1024);
+    buf_->size = buf_->buffer ? kRecordChunk + 1024 : 0;
+    if (format_ == ListFormat::kCsv) {
+        HJson_concat(buf_, "id,description,status,created_at,updated_at\n");
+    } else if (format_ == ListFormat::kJson) {
+        HJson_putc(buf_, '[');
+    }
+}
+
+RecordWriter::~RecordWriter() {
+    Finish();
+    free(buf_->buffer);
+    delete buf_;
+}
+
+void RecordWriter::Row(const Task& t) {
+    char num[kTaskTimeLen];
+    switch (format_) {
+    case ListFormat::kJson:
+        if (rows_) {
+            HJson_putc(buf_, ',');
+        }
+        HJson_writeRecord(buf_, t);
+        break;
+    case ListFormat::kNdjson:
+        HJson_writeRecord(buf_, t);
+        HJson_putc(buf_, '\n');
+        break;
+    case ListFormat::kCsv:
+        HJson_append(buf_, num, HJson_writeInt64(num, t.id));
+        HJson_putc(buf_, ',');
+        csvField(t.description);
+        HJson_putc(buf_, ',');
+        HJson_append(buf_, num, HJson_writeInt64(num, t.status));
+        HJson_putc(buf_, ',');
+        // Times never need quoting
+        FormatTaskTime(t.created_at, num);
+        HJson_append(buf_, num, kTaskTimeLen);
+        HJson_putc(buf_, ',');
+        FormatTaskTime(t.updated_at, num);
+        HJson_append(buf_, num, kTaskTimeLen);
+        HJson_putc(buf_, '\n');
+        break;
+    case ListFormat::kTable:
+        break;
+    }
+    rows_++;
+    spill(false);
+}
+
+void RecordWriter::Finish() {
+    if (finished_) {
+        return;
+    }
+    if (format_ == ListFormat::kJson) {
+        HJson_concat(buf_, "]\n");
+    }
+    spill(true);
+    finished_ = true;
+}
+
+// Quoted only when it has to be, quotes inside doubled (RFC 4180)
+void RecordWriter::csvField(const std::string& v) {
+    if (v.find_first_of(",\"\r\n") == std::string::npos) {
+        HJson_append(buf_, v.data(), v.size());
+        return;
+    }
+    HJson_putc(buf_, '"');
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (v[i] == '"') {
+            HJson_putc(buf_, '"');
+        }
+        HJson_putc(buf_, v[i]);
+    }
+    HJson_putc(buf_, '"');
+}
+
+void RecordWriter::spill(bool force) {
+    if (buf_->offset > 0 && (force || buf_->offset >= kRecordChunk)) {
+        fwrite(buf_->buffer, 1, buf_->offset, out_);
+        // Readers downstream get every full chunk right away
+        fflush(out_);
+        buf_->offset = 0;
+    }
+}
@@ -0,0 +1,115 @@
+#include "table_writer.hpp"
+#include "task_time.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const size_t kTableChunk = 64 * 1024;
+
+static const char* const kTableHead[] = {
+    "id", "description", "status", "created_time", "updated_time"
+};
+
+// Decimal of v zero padded to at least width digits, returns its length
+static size_t FormatPadded(char* out, uint32_t v, size_t width) {
+    char tmp[16];
+    size_t n = 0;
+    do {
+        tmp[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n < width) {
+        tmp[n++] = '0';
+    }
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+// Status as signed decimal, returns its length
+static size_t FormatStatus(char* out, int status) {
+    if (status < 0) {
+        out[0] = '-';
+        return 1 + FormatPadded(out + 1, -static_cast<int64_t>(status), 1);
+    }
+    return FormatPadded(out, status, 1);
+}
+
+TableWriter::TableWriter(FILE* out)
+    : out_(out) {
+    buf_.reserve(kTableChunk + 1024);
+}
+
+TableWriter::~TableWriter() {
+    Flush();
+}
+
+void TableWriter::Render(const std::vector<const Task*>& rows) {
+    char id[16], status[16], time[kTaskTimeLen];
+    for (int c = 0; c < kColumns; ++c) {
+        widths_[c] = strlen(kTableHead[c]);
+    }
+    // Ids are printed with four digits at least, times all have one width
+    widths_[0] = std::max<size_t>(widths_[0], 4);
+    widths_[3] = std::max(widths_[3], kTaskTimeLen);
+    widths_[4] = std::max(widths_[4], kTaskTimeLen);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Task* t = rows[i];
+        widths_[0] = std::max(widths_[0], FormatPadded(id, t->id, 4));
+        widths_[1] = std::max(widths_[1], t->description.size());
+        widths_[2] = std::max(widths_[2], FormatStatus(status, t->status));
+    }
+    rule();
+    for (int c = 0; c < kColumns; ++c) {
+        cell(c, kTableHead[c], strlen(kTableHead[c]));
+    }
+    buf_.append("|\n");
+    rule();
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const Task* t = rows[i];
+        cell(0, id, FormatPadded(id, t->id, 4));
+        cell(1, t->description.data(), t->description.size());
+        cell(2, status, FormatStatus(status, t->status));
+        FormatTaskTime(t->created_at, time);
+        cell(3, time, kTaskTimeLen);
+        FormatTaskTime(t->updated_at, time);
+        cell(4, time, kTaskTimeLen);
+        buf_.append("|\n");
+        spill();
+    }
+    if (!rows.empty()) {
+        rule();
+    }
+}
+
+void TableWriter::Flush() {
+    if (!buf_.empty()) {
+        fwrite(buf_.data(), 1, buf_.size(), out_);
+        buf_.clear();
+    }
+    fflush(out_);
+}
+
+void TableWriter::rule() {
+    for (int c = 0; c < kColumns; ++c) {
+        buf_.push_back('+');
+        buf_.append(widths_[c] + 2, '-');
+    }
+    buf_.append("+\n");
+}
+
+// Text centred in its column, one blank either side at least
+void TableWriter::cell(int column, const char* text, size_t len) {
+    size_t pad = widths_[column] - len;
+    buf_.append("| ");
+    buf_.append(pad / 2, ' ');
+    buf_.append(text, len);
+    buf_.append(pad - pad / 2 + 1, ' ');
+}
+
+void TableWriter::spill() {
+    if (buf_.size() >= kTableChunk) {
+        fwrite(buf_.data(), 1, buf_.size(), out_);
+        buf_.clear();
+    }
+}
@@ -1,4 +1,39 @@
 #include "task_handler.hpp"
+#include "task_server.hpp"
+#include <fstream>
+#include <unistd.h>
+
+// Run the command in the serving process behind fd. Batch input and
+// relative paths are resolved here, the server may run elsewhere.
+static int RunRemote(int fd, const std::string& cmd, const std::vector<std::string>& args) {
+    ServeRequest req;
+    req.words.push_back(cmd);
+    req.words.insert(req.words.end(), args.begin(), args.end());
+    if (cmd == kBatchCmd) {
+        std::ostringstream input;
+        if (args.empty() || args[0] == "-") {
+            input << std::cin.rdbuf();
+        } else {
+            std::ifstream file(args[0].c_str());
+            ErrIf(!file, "Failed to open %s.", args[0].c_str());
+            input << file.rdbuf();
+        }
+        req.input = input.str();
+        req.words.resize(1);
+        req.words.push_back("-");
+    } else if (cmd == kConvertCmd && !args.empty() && args[0][0] != '/') {
+        char cwd[4096];
+        ErrIf(!getcwd(cwd, sizeof(cwd)), "Failed to resolve %s.", args[0].c_str());
+        req.words[1] = std::string(cwd) + "/" + args[0];
+    }
+    ServeReply reply;
+    bool ok = ServeCall(fd, req, &reply);
+    close(fd);
+    ErrIf(!ok, "Lost connection to %s.", TaskHandler::SocketPath().c_str());
+    fwrite(reply.out.data(), 1, reply.out.size(), stdout);
+    fwrite(reply.err.data(), 1, reply.err.size(), stderr);
+    return reply.rc;
+}
 
 int main(int argc, char const *argv[])
 {
@@ -9,7 +44,7 @@ int main(int argc, char const *argv[])
     }
     std::string cmd = argv[1];
     auto iter = support_cmd.find(cmd);
-    ErrIf(iter == support_cmd.end(), "Unsupport command: [%s].", cmd);
+    ErrIf(iter == support_cmd.end(), "Unsupport command: [%s].", cmd.c_str());
     // Check argc
     ErrIf(argc < iter->second, "Unexpected argument count, expected: %d, got: %d.", iter->second, argc);
     // Get argv
@@ -17,7 +52,27 @@ int main(int argc, char const *argv[])
     for (int i = 2; i < argc; ++i) {
         args.emplace_back(argv[i]);
     }
+    // A serving process already has everything loaded, hand the command over
+    if (cmd != kServeCmd && !getenv("TTC_NO_SERVE")) {
+        int fd = ServeConnect(TaskHandler::SocketPath());
+        if (fd >= 0) {
+            return RunRemote(fd, cmd, args);
+        }
+    }
     TaskHandler th;
-    th.Handle(cmd, args);
-    return 0;
+    int rc = 0;
+    if (cmd == kServeCmd) {
+        TaskServer server(&th);
+        rc = server.Run(TaskHandler::SocketPath());
+    } else {
+        rc = th.Handle(cmd, args);
+        // A change that did not reach the disk fails the command
+        if (!th.Unlock()) {
+            rc = 1;
+        }
+    }
+    if (rc && !ErrLast().empty()) {
+        fprintf(stderr, "%s\n", ErrLast().c_str());
+    }
+    return rc;
 }
@@ -0,0 +1,126 @@
+#include "task_client.hpp"
+#include "byte_codec.hpp"
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Length prefix written once the frame body is in place
+static void SealFrame(std::string& out, size_t start) {
+    uint32_t len = out.size() - start - kServeFrameHeader;
+    std::string header;
+    PutFixed32(header, len);
+    out.replace(start, kServeFrameHeader, header);
+}
+
+void EncodeRequest(std::string& out, const ServeRequest& req) {
+    size_t start = out.size();
+    out.append(kServeFrameHeader, '\0');
+    PutVarint(out, req.words.size());
+    for (size_t i = 0; i < req.words.size(); ++i) {
+        PutBytes(out, req.words[i]);
+    }
+    PutBytes(out, req.input);
+    SealFrame(out, start);
+}
+
+bool DecodeRequest(const char* p, const char* end, ServeRequest* req) {
+    uint64_t count = 0;
+    if (!GetVarint(p, end, &count) || count > (uint64_t)(end - p)) {
+        return false;
+    }
+    req->words.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        if (!GetBytes(p, end, &req->words[i])) {
+            return false;
+        }
+    }
+    return GetBytes(p, end, &req->input) && p == end;
+}
+
+void EncodeReply(std::string& out, const ServeReply& reply) {
+    size_t start = out.size();
+    out.append(kServeFrameHeader, '\0');
+    PutVarint(out, static_cast<uint32_t>(reply.rc));
+    PutBytes(out, reply.out);
+    PutBytes(out, reply.err);
+    SealFrame(out, start);
+}
+
+bool DecodeReply(const char* p, const char* end, ServeReply* reply) {
+    uint64_t rc = 0;
+    if (!GetVarint(p, end, &rc)) {
+        return false;
+    }
+    reply->rc = static_cast<int>(static_cast<uint32_t>(rc));
+    return GetBytes(p, end, &reply->out) && GetBytes(p, end, &reply->err) && p == end;
+}
+
+int ServeConnect(const std::string& path) {
+    struct sockaddr_un addr = {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool SendAll(int fd, const char* p, size_t left) {
+    while (left > 0) {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+static bool RecvAll(int fd, char* p, size_t left) {
+    while (left > 0) {
+        ssize_t n = recv(fd, p, left, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+bool ServeCall(int fd, const ServeRequest& req, ServeReply* reply) {
+    std::string frame;
+    EncodeRequest(frame, req);
+    if (!SendAll(fd, frame.data(), frame.size())) {
+        return false;
+    }
+    char header[kServeFrameHeader];
+    if (!RecvAll(fd, header, kServeFrameHeader)) {
+        return false;
+    }
+    uint32_t len = GetFixed32(header);
+    if (len > kServeMaxFrame) {
+        return false;
+    }
+    std::string body(len, '\0');
+    if (!RecvAll(fd, &body[0], len)) {
+        return false;
+    }
+    return DecodeReply(body.data(), body.data() + len, reply);
+}
@@ -1,6 +1,13 @@
 #include "task_handler.hpp"
 #include "hjson.hpp"
+#include "record_writer.hpp"
+#include "table_writer.hpp"
+#include "text_index.hpp"
+#include "task_time.hpp"
+#include <algorithm>
 #include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 
 static std::unordered_map<std::string, TaskStatus> support_list_cmds = {
     {"done", TaskStatus::kDone},
@@ -8,217 +15,902 @@ static std::unordered_map<std::string, TaskStatus> support_list_cmds = {
     {"in-progress", TaskStatus::kInProgress}
 };
 
-TaskHandler::TaskHandler(): latest_id_(1), updated_(false) {
-    init();
+enum class SortKey {
+    kId,
+    kStatus,
+    kCreated,
+    kUpdated,
+    kDescription
+};
+
+// What list shows: tasks with one status that pass every bound, in sort
+// order, offset and limit cut the window out of that order. Ids are
+// inclusive, times include from and exclude to.
+struct ListQuery {
+    TaskStatus status = TaskStatus::kUnknown;
+    TaskId min_id = 0;
+    TaskId max_id = kMaxTaskId;
+    TaskTime created_from = kMinTaskTime;
+    TaskTime created_to = kMaxTaskTime + 1;
+    TaskTime updated_from = kMinTaskTime;
+    TaskTime updated_to = kMaxTaskTime + 1;
+    SortKey sort = SortKey::kId;
+    bool descending = false;
+    size_t offset = 0;
+    size_t limit = SIZE_MAX;
+    ListFormat format = ListFormat::kTable;
+
+    // Some bound beyond the status is set
+    bool Filtered() const {
+        return min_id > 0 || max_id < kMaxTaskId || created_from > kMinTaskTime || created_to <= kMaxTaskTime
+            || updated_from > kMinTaskTime || updated_to <= kMaxTaskTime;
+    }
+
+    // Never looks at the description, see TaskKeep
+    bool Match(const Task& t) const {
+        return (status == TaskStatus::kUnknown || t.status == static_cast<int>(status))
+            && t.id >= min_id && t.id <= max_id
+            && t.created_at >= created_from && t.created_at < created_to
+            && t.updated_at >= updated_from && t.updated_at < updated_to;
+    }
+
+    // a comes before b in the sort order, ids break ties
+    bool Before(const Task* a, const Task* b) const {
+        int cmp = 0;
+        switch (sort) {
+        case SortKey::kId:
+            break;
+        case SortKey::kStatus:
+            cmp = a->status < b->status ? -1 : a->status > b->status;
+            break;
+        case SortKey::kCreated:
+            cmp = a->created_at < b->created_at ? -1 : a->created_at > b->created_at;
+            break;
+        case SortKey::kUpdated:
+            cmp = a->updated_at < b->updated_at ? -1 : a->updated_at > b->updated_at;
+            break;
+        case SortKey::kDescription:
+            cmp = a->description.compare(b->description);
+            break;
+        }
+        if (cmp == 0) {
+            cmp = a->id < b->id ? -1 : a->id > b->id;
+        }
+        return descending ? cmp > 0 : cmp < 0;
+    }
+};
+
+// Backend picked by TTC_STORAGE, json unless it says binary
+static bool UseBinaryStorage() {
+    const char* kind = getenv("TTC_STORAGE");
+    return kind && !strcmp(kind, "binary");
+}
+
+static TaskStorage* OpenStorage() {
+    if (UseBinaryStorage()) {
+        return CreateStorage(StorageKind::kBinary, kTaskBinaryName);
+    }
+    return CreateStorage(StorageKind::kJson, kTaskDataBaseName);
+}
+
+std::string TaskHandler::SocketPath() {
+    return std::string(UseBinaryStorage() ? kTaskBinaryName : kTaskDataBaseName) + kTaskSocketSuffix;
+}
+
+// Group commit settings, defaults overridden from the environment
+static CommitPolicy LoadCommitPolicy() {
+    CommitPolicy policy = { kCommitDelayUs };
+    const char* delay = getenv("TTC_COMMIT_DELAY_US");
+    if (delay && atoi(delay) >= 0) {
+        policy.delay_us = atoi(delay);
+    }
+    return policy;
+}
+
+TaskHandler::TaskHandler()
+    : updated_(false)
+    , storage_(OpenStorage())
+    , log_((storage_->Path() + kTaskLogSuffix).c_str(), LoadCommitPolicy())
+    , snapshot_size_(0)
+    , loaded_(false)
+    , partial_(false)
+    , out_(stdout)
+    , err_(stderr)
+    , snapshot_stamp_()
+    , log_stamp_() {
+    FileLockInit(&lock_, storage_->Path() + kTaskLockSuffix);
 }
 
 TaskHandler::~TaskHandler() {
-    if (updated_)
-    {
-        flush();   
+    Unlock();
+    FileLockClose(&lock_);
+}
+
+bool TaskHandler::Load() {
+    return lock(LOCK_SH) && load(false, 0);
+}
+
+bool TaskHandler::Commit() {
+    if (!updated_) {
+        return true;
     }
+    updated_ = false;
+    // A command returns only once its records are on disk
+    if (!commit() || !sync()) {
+        dropUncommitted();
+        return false;
+    }
+    return true;
+}
+
+bool TaskHandler::Compact() {
+    if (!lock(LOCK_EX) || !load(false, 0) || !Commit()) {
+        return false;
+    }
+    return log_.Size() == 0 || compact();
+}
+
+bool TaskHandler::Unlock() {
+    bool wrote = updated_;
+    bool ok = !wrote || commit();
+    updated_ = false;
+    if (lock_.mode != LOCK_UN) {
+        // What is on disk now is what the table holds, own writes included
+        stampStore(&snapshot_stamp_, &log_stamp_);
+        FileLockRelease(&lock_);
+    }
+    // Synced without the lock, so writers in other processes can append
+    // during the commit delay and share this sync
+    ok = ok && (!wrote || sync());
+    if (!ok) {
+        dropUncommitted();
+    }
+    return ok;
+}
+
+// The table is ahead of the files, the next command reads them again
+void TaskHandler::dropUncommitted() {
+    unload();
+    log_.Close();
+}
+
+// Commands that read and change exactly the task named by args[0]
+static bool IsPointCmd(const std::string& cmd) {
+    return cmd == kUpdateCmd || cmd == kDeleteCmd || cmd == kMarkProgCmd || cmd == kMarkDoneCmd;
+}
+
+// Commands that leave the store as it is
+static bool IsReadCmd(const std::string& cmd) {
+    return cmd == kListCmd || cmd == kConvertCmd || cmd == kSearchCmd;
 }
 
 int TaskHandler::Handle(const std::string& cmd, const std::vector<std::string>& args) {
+    TaskId id = 0;
+    bool point = IsPointCmd(cmd) && !args.empty() && ParseTaskId(args[0], &id);
+    // Loading runs beside readers and other loads, only the change itself
+    // waits for the exclusive lock
+    if (!lock(LOCK_SH)) {
+        return 1;
+    }
+    // list and search load what they need themselves
+    if (cmd != kListCmd && cmd != kSearchCmd && !load(point, id)) {
+        return 1;
+    }
+    if (!IsReadCmd(cmd) && (!lock(LOCK_EX) || (!loaded_ && !load(point, id)))) {
+        return 1;
+    }
     if (cmd == kAddCmd) {
-        ErrIf(args.size() < 1, "Missing required arguments.");
+        ErrRetIf(args.size() < 1, 1, "Missing required arguments.");
         return handleAddTask(args[0]);
     } else if (cmd == kUpdateCmd) {
-        ErrIf(args.size() < 2, "Missing required arguments.");
+        ErrRetIf(args.size() < 2, 1, "Missing required arguments.");
         return handleUpdateTask(args);
     } else if (cmd == kDeleteCmd) {
-        ErrIf(args.size() < 1, "Missing required arguments.");
+        ErrRetIf(args.size() < 1, 1, "Missing required arguments.");
         return handleDeleteTask(args[0]);
     } else if (cmd == kMarkProgCmd) {
-        ErrIf(args.size() < 1, "Missing required arguments.");
+        ErrRetIf(args.size() < 1, 1, "Missing required arguments.");
         return handleMarkTask(args[0], TaskStatus::kInProgress);
     } else if (cmd == kMarkDoneCmd) {
-        ErrIf(args.size() < 1, "Missing required arguments.");
+        ErrRetIf(args.size() < 1, 1, "Missing required arguments.");
         return handleMarkTask(args[0], TaskStatus::kDone);
     } else if (cmd == kListCmd) {
-        ErrIf(args.size() > 2, "Missing required arguments.");
         return handleListTask(args);
-    } else {
-        fprintf(stderr, "Unknown cmd: [%s].", cmd.c_str());
-        return 1;
+    } else if (cmd == kSearchCmd) {
+        return handleSearch(args);
+    } else if (cmd == kConvertCmd) {
+        ErrRetIf(args.size() < 1, 1, "Missing required arguments.");
+        return handleConvert(args[0]);
+    } else if (cmd == kBatchCmd) {
+        return handleBatch(args);
+    }
+    ErrRetIf(true, 1, "Unknown cmd: [%s].", cmd.c_str());
+    return 1;
+}
+
+bool TaskHandler::lock(int mode) {
+    if (lock_.mode == mode || lock_.mode == LOCK_EX) {
+        return true;
     }
+    ErrRetIf(!FileLockAcquire(&lock_, mode), false, "Failed to lock %s.", lock_.path.c_str());
+    if (loaded_ && !storeUnchanged()) {
+        // Another process wrote while we held no lock, or while flock
+        // traded our shared lock for the exclusive one
+        unload();
+        log_.Close();
+    }
+    return true;
+}
+
+bool TaskHandler::load(bool point, TaskId id) {
+    if (loaded_ && !partial_) {
+        return true;
+    }
+    if (loaded_) {
+        // The partial table served one command, the next reads from scratch
+        if (!Commit()) {
+            return false;
+        }
+        unload();
+    }
+    return (point && initSome(std::vector<TaskId>(1, id), false)) || init();
+}
+
+void TaskHandler::unload() {
+    task_table_ = TaskTable();
+    text_index_.reset();
+    dirty_ = IdSet();
+    loaded_ = false;
+    partial_ = false;
+}
+
+void TaskHandler::stampStore(FileStamp* snapshot, FileStamp* log) const {
+    *snapshot = FileStampOf(storage_->Path());
+    *log = FileStampOf(storage_->Path() + kTaskLogSuffix);
+}
+
+bool TaskHandler::storeUnchanged() const {
+    FileStamp snapshot, log;
+    stampStore(&snapshot, &log);
+    return FileStampEqual(snapshot, snapshot_stamp_) && FileStampEqual(log, log_stamp_);
+}
+
+// Move tasks into the empty table, false and the table emptied again if
+// some id is out of range
+bool TaskHandler::putAll(std::vector<Task>& tasks) {
+    bool ok = true;
+    for (auto iter = tasks.begin(); iter != tasks.end() && ok; ++iter) {
+        ok = task_table_.Put(std::move(*iter));
+    }
+    if (!ok) {
+        unload();
+    }
+    ErrRetIf(!ok, false, "Bad task id in %s.", storage_->Path().c_str());
+    return true;
+}
+
+// One line per load for stored times that did not parse, the tasks load
+// with kUnknownTaskTime in their place
+void TaskHandler::warnUnknownTimes(size_t before) {
+    size_t count = UnknownTaskTimes() - before;
+    if (count > 0) {
+        fprintf(err_, "%zu times in %s do not parse, read as 0000-01-01 00:00:00.\n",
+                count, storage_->Path().c_str());
+    }
+}
+
+bool TaskHandler::init() {
+    std::vector<Task> tasks;
+    std::vector<LogRecord> records;
+    const char* path = storage_->Path().c_str();
+    size_t unknown = UnknownTaskTimes();
+    ErrRetIf(!storage_->Load(tasks, &snapshot_size_), false, "Failed to load %s.", path);
+    warnUnknownTimes(unknown);
+    // Mutations made since the snapshot
+    ErrRetIf(!log_.Replay(records), false, "Failed to read %s%s.", path, kTaskLogSuffix);
+    if (!putAll(tasks)) {
+        return false;
+    }
+    for (auto iter = records.begin(); iter != records.end(); ++iter) {
+        applyRecord(*iter);
+    }
+    stampStore(&snapshot_stamp_, &log_stamp_);
+    loaded_ = true;
+    return true;
+}
+
+// Load the tasks with ids and their log records only, with logged every
+// task the log touches as well. False if that did not work out and init()
+// has to run instead, it reports any error.
+bool TaskHandler::initSome(std::vector<TaskId> ids, bool logged) {
+    std::vector<LogRecord> records;
+    if (!log_.Replay(records)) {
+        return false;
+    }
+    if (logged) {
+        for (auto iter = records.begin(); iter != records.end(); ++iter) {
+            ids.push_back(iter->task.id);
+        }
+    }
+    std::vector<Task> tasks;
+    size_t unknown = UnknownTaskTimes();
+    if (!storage_->LoadSome(ids, tasks, &snapshot_size_)) {
+        return false;
+    }
+    warnUnknownTimes(unknown);
+    for (auto iter = tasks.begin(); iter != tasks.end(); ++iter) {
+        task_table_.Put(std::move(*iter));
+    }
+    IdSet wanted;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        wanted.Set(ids[i]);
+    }
+    for (auto iter = records.begin(); iter != records.end(); ++iter) {
+        if (wanted.Test(iter->task.id)) {
+            applyRecord(*iter);
+        }
+    }
+    stampStore(&snapshot_stamp_, &log_stamp_);
+    loaded_ = true;
+    partial_ = true;
+    return true;
+}
+
+// Load only tasks q can list, the filter is pushed into the backend so
+// the rest are dropped while reading. Tasks the log touches are loaded
+// whatever their snapshot record says, the log may still change them.
+bool TaskHandler::initFiltered(const ListQuery& q) {
+    std::vector<LogRecord> records;
+    const char* path = storage_->Path().c_str();
+    ErrRetIf(!log_.Replay(records), false, "Failed to read %s%s.", path, kTaskLogSuffix);
+    IdSet touched;
+    for (auto iter = records.begin(); iter != records.end(); ++iter) {
+        touched.Set(iter->task.id);
+    }
+    std::vector<Task> tasks;
+    TaskKeep keep = [&q, &touched](const Task& t) {
+        return touched.Test(t.id) || q.Match(t);
+    };
+    size_t unknown = UnknownTaskTimes();
+    ErrRetIf(!storage_->Load(tasks, &snapshot_size_, keep), false, "Failed to load %s.", path);
+    warnUnknownTimes(unknown);
+    if (!putAll(tasks)) {
+        return false;
+    }
+    for (auto iter = records.begin(); iter != records.end(); ++iter) {
+        applyRecord(*iter);
+    }
+    stampStore(&snapshot_stamp_, &log_stamp_);
+    loaded_ = true;
+    partial_ = true;
+    return true;
+}
+
+// Replay is idempotent, records may be applied again on top of a snapshot
+// that already contains them if a crash hit between compaction steps.
+void TaskHandler::applyRecord(const LogRecord& r) {
+    Task* t = task_table_.Find(r.task.id);
+    // Snapshot bytes of this task are stale from here on
+    dirty_.Set(r.task.id);
+    switch (r.op) {
+    case LogOp::kAdd:
+        reindex(r.task.id, t ? t->description : std::string(), r.task.description);
+        task_table_.Put(r.task);
+        break;
+    case LogOp::kUpdate:
+        if (t) {
+            reindex(t->id, t->description, r.task.description);
+            t->description = r.task.description;
+            t->updated_at = r.task.updated_at;
+        }
+        break;
+    case LogOp::kMark:
+        if (t) {
+            task_table_.SetStatus(t, r.task.status);
+            t->updated_at = r.task.updated_at;
+        }
+        break;
+    case LogOp::kDelete:
+        if (t) {
+            reindex(t->id, t->description, std::string());
+        }
+        task_table_.Erase(r.task.id);
+        break;
+    }
+}
+
+bool TaskHandler::commit() {
+    const char* path = storage_->Path().c_str();
+    ErrRetIf(!log_.Commit(), false, "Failed to write %s%s.", path, kTaskLogSuffix);
+    size_t log_size = log_.Size();
+    if (log_size < kLogCompactMinBytes) {
+        return true;
+    }
+    if (log_size >= kLogCompactBytes || log_size >= snapshot_size_ * kLogCompactRatio) {
+        return compact();
+    }
+    return true;
+}
+
+bool TaskHandler::sync() {
+    const char* path = storage_->Path().c_str();
+    ErrRetIf(!log_.Sync(), false, "Failed to sync %s%s.", path, kTaskLogSuffix);
+    return true;
 }
 
-void TaskHandler::init() {
-    HJson* root_node = 0;
-    std::ifstream in(kTaskDataBaseName);
-    std::ostringstream oss;
-    oss << in.rdbuf();
-    std::string task_content = oss.str();
-    root_node = HJson_parse(task_content.c_str());
-    HJson* ptr = root_node->child;
-    while (ptr) {
+bool TaskHandler::compact() {
+    if (partial_) {
+        // Compaction needs every task, the log now holds this command
+        unload();
+        if (!init()) {
+            return false;
+        }
+    }
+    // Snapshot first, the log is only dropped once its records are in it
+    if (!flush()) {
+        return false;
+    }
+    dirty_ = IdSet();
+    // Keep the search index in step with the new snapshot, if anyone searches
+    if (text_index_ || access(termsPath().c_str(), F_OK) == 0) {
+        saveTextIndex();
+    }
+    const char* path = storage_->Path().c_str();
+    ErrRetIf(!log_.Reset(), false, "Failed to remove %s%s.", path, kTaskLogSuffix);
+    // The snapshot only knows live ids. When the highest ids were deleted
+    // the fresh log keeps the last delete, so replay still skips past it.
+    TaskId last = task_table_.NextId() - 1;
+    if (last > 0 && !task_table_.Find(last)) {
         Task t{};
-        HJson* p = ptr->child;
-        while (p) {
-            std::string key = p->key;
-            if (key == "id") {
-                t.id = p->sv;
-            } else if (key == "description") {
-                t.description = p->sv;
-            } else if (key == "status") {
-                t.status = p->biv;
-            } else if (key == "created_at") {
-                t.created_at = p->sv;
-            } else if (key == "updated_at") {
-                t.updated_at = p->sv;
-            }
-            p = p->next;
-        }
-        task_cache_[t.id] = t;
-        task_all_.push_back(t);
-        TaskStatus status = static_cast<TaskStatus>(t.status);
-        if (status == TaskStatus::kTodo) {
-            task_todo_.push_back(t);
-        } else if (status == TaskStatus::kInProgress) {
-            task_progress_.push_back(t);
-        } else if (status == TaskStatus::kDone) {
-            task_done_.push_back(t);
-        }
-        latest_id_++;
-        ptr = ptr->next;
-    }
-    in.close();
-    HJson_delete(root_node);
-}
-
-void TaskHandler::flush() {
-    HJson* array_node = HJson_createArray();
-    for (auto iter = task_cache_.begin(); iter != task_cache_.end(); ++iter) {
-        Task& t = iter->second;
-        HJson* object_node = HJson_createObject();
-        HJson* id_node = HJson_createString(t.id.c_str());
-        HJson* description_node = HJson_createString(t.description.c_str());
-        HJson* status_node = HJson_createNumber(t.status);
-        HJson* created_node = HJson_createString(t.created_at.c_str());
-        HJson* updated_node = HJson_createString(t.updated_at.c_str());
-        HJson_addItemToObject(object_node, "id", id_node);
-        HJson_addItemToObject(object_node, "description", description_node);
-        HJson_addItemToObject(object_node, "status", status_node);
-        HJson_addItemToObject(object_node, "created_at", created_node);
-        HJson_addItemToObject(object_node, "updated_at", updated_node);
-        HJson_addItem(array_node, object_node);
-    }
-    int out_len = 0;
-    const char* ret = HJson_write(array_node, out_len);
+        t.id = last;
+        log_.Append(LogOp::kDelete, t);
+        ErrRetIf(!log_.Commit() || !log_.Sync(), false, "Failed to write %s%s.", path, kTaskLogSuffix);
+    }
+    return true;
+}
+
+TaskRefs TaskHandler::allTasks() const {
+    TaskRefs tasks;
+    tasks.reserve(task_table_.Size());
+    task_table_.ForEach([&tasks](const Task& t) {
+        tasks.push_back(&t);
+    });
+    return tasks;
+}
+
+bool TaskHandler::flush() {
+    TaskRefs tasks = allTasks();
 #ifdef _DEBUG
     std::cout
         << "Flush content: "
-        << '\n'
-        << ret
         << std::endl;
+    JsonStorage::Write(STDOUT_FILENO, tasks);
+    std::cout << std::endl;
 #endif // _DEBUG
-    // Write to json file
-    std::ofstream of(kTaskDataBaseName, std::ios::out);
-    of.write(ret, out_len);
-    of.close();
-    delete ret;
-    HJson_delete(array_node);
+    ErrRetIf(!storage_->Save(tasks, &dirty_), false, "Failed to write %s.", storage_->Path().c_str());
+    return true;
+}
+
+// Task named by a command line id, 0 if there is none
+Task* TaskHandler::findTask(const std::string& arg) {
+    TaskId id = 0;
+    Task* t = ParseTaskId(arg, &id) ? task_table_.Find(id) : 0;
+    ErrRetIf(!t, 0, "Not found this task.");
+    return t;
 }
 
 int TaskHandler::handleAddTask(const std::string& args) {
-    std::string id = std::to_string(latest_id_);
+    TaskTime now = TaskTimeNow();
     Task t {
-        .id = id,
+        .id = task_table_.NextId(),
         .description = args,
         .status = static_cast<int>(TaskStatus::kTodo),
-        .created_at = GetCurrentTime(),
-        .updated_at = GetCurrentTime()
+        .created_at = now,
+        .updated_at = now
     };
-    task_cache_[id] = t;
+    ErrRetIf(!task_table_.Put(t), 1, "Out of task ids.");
+    dirty_.Set(t.id);
+    reindex(t.id, std::string(), t.description);
+    log_.Append(LogOp::kAdd, t);
     updated_ = true;
     return 0;
 }
 
 int TaskHandler::handleUpdateTask(const std::vector<std::string>& args) {
-    auto iter = task_cache_.find(args[0]);
-    ErrIf(iter == task_cache_.end(), "Not found this task.");
-    iter->second.description = args[1];
-    iter->second.updated_at = GetCurrentTime();
+    Task* t = findTask(args[0]);
+    if (!t) {
+        return 1;
+    }
+    dirty_.Set(t->id);
+    reindex(t->id, t->description, args[1]);
+    t->description = args[1];
+    t->updated_at = TaskTimeNow();
+    log_.Append(LogOp::kUpdate, *t);
     updated_ = true;
     return 0;
 }
 
 int TaskHandler::handleMarkTask(const std::string& arg, TaskStatus status) {
-    auto iter = task_cache_.find(arg);
-    ErrIf(iter == task_cache_.end(), "Not found this task.");
-    iter->second.status = static_cast<int>(status);
-    iter->second.updated_at = GetCurrentTime();
+    Task* t = findTask(arg);
+    if (!t) {
+        return 1;
+    }
+    dirty_.Set(t->id);
+    task_table_.SetStatus(t, static_cast<int>(status));
+    t->updated_at = TaskTimeNow();
+    log_.Append(LogOp::kMark, *t);
     updated_ = true;
     return 0;
 }
 
 int TaskHandler::handleDeleteTask(const std::string& arg) {
-    ErrIf(task_cache_.find(arg) == task_cache_.end(), "Not found this task.");
-    task_cache_.erase(arg);
+    Task* t = findTask(arg);
+    if (!t) {
+        return 1;
+    }
+    log_.Append(LogOp::kDelete, *t);
+    reindex(t->id, t->description, std::string());
+    task_table_.Erase(t->id);
     updated_ = true;
     return 0;
 }
 
+// Non-negative decimal that fits size_t
+static bool ParseCount(const std::string& str, size_t* count) {
+    if (str.empty() || str.size() > 18 || str.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    *count = strtoull(str.c_str(), 0, 10);
+    return true;
+}
+
+// "YYYY-MM-DD", optionally followed by " hh:mm:ss" or a leading part of
+// it. A part left out reads as its lowest value, the bound then falls
+// where the text itself would sort among full times.
+static bool ParseTimeBound(const std::string& str, TaskTime* t) {
+    static const char kLowest[] = "0000-01-01 00:00:00";
+    if (str.size() < 10 || str.size() > kTaskTimeLen) {
+        return false;
+    }
+    std::string full = str + (kLowest + str.size());
+    return ParseTaskTime(full, t);
+}
+
+static bool ParseSortKey(std::string name, ListQuery* q) {
+    static const std::unordered_map<std::string, SortKey> keys = {
+        {"id", SortKey::kId},
+        {"status", SortKey::kStatus},
+        {"created", SortKey::kCreated},
+        {"updated", SortKey::kUpdated},
+        {"description", SortKey::kDescription}
+    };
+    q->descending = !name.empty() && name[0] == '-';
+    auto iter = keys.find(q->descending ? name.substr(1) : name);
+    if (iter == keys.end()) {
+        return false;
+    }
+    q->sort = iter->second;
+    return true;
+}
+
+// list [status] [--limit N] [--offset N] [--format F] [--sort [-]KEY]
+// [--min-id N] [--max-id N] [--created-after T] [--created-before T]
+// [--updated-after T] [--updated-before T], options also as --name=value.
+// With words, other arguments go there instead of naming a status.
+static bool ParseListQuery(const std::vector<std::string>& args, ListQuery* q,
+                           std::vector<std::string>* words = 0) {
+    bool has_status = false;
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg.compare(0, 2, "--") != 0 && words) {
+            words->push_back(arg);
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            auto iter = support_list_cmds.find(arg);
+            ErrRetIf(has_status || iter == support_list_cmds.end(), false,
+                     "Unknown list argument: [%s].", arg.c_str());
+            q->status = iter->second;
+            has_status = true;
+            continue;
+        }
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value;
+        if (eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+        } else if (i + 1 < args.size()) {
+            value = args[++i];
+        }
+        if (name == "--format") {
+            ErrRetIf(!ParseListFormat(value, &q->format), false, "Unknown format: [%s].", value.c_str());
+            continue;
+        }
+        if (name == "--sort") {
+            ErrRetIf(!ParseSortKey(value, q), false, "Unknown sort key: [%s].", value.c_str());
+            continue;
+        }
+        if (name == "--min-id" || name == "--max-id") {
+            TaskId* target = name == "--min-id" ? &q->min_id : &q->max_id;
+            ErrRetIf(!ParseTaskId(value, target), false, "Bad value for %s: [%s].", name.c_str(), value.c_str());
+            continue;
+        }
+        TaskTime* bound = name == "--created-after" ? &q->created_from
+            : name == "--created-before" ? &q->created_to
+            : name == "--updated-after" ? &q->updated_from
+            : name == "--updated-before" ? &q->updated_to : 0;
+        if (bound) {
+            ErrRetIf(!ParseTimeBound(value, bound), false, "Bad time for %s: [%s].", name.c_str(), value.c_str());
+            continue;
+        }
+        size_t* target = name == "--limit" ? &q->limit : name == "--offset" ? &q->offset : 0;
+        ErrRetIf(!target, false, "Unknown list option: [%s].", name.c_str());
+        ErrRetIf(!ParseCount(value, target), false, "Bad value for %s: [%s].", name.c_str(), value.c_str());
+    }
+    return true;
+}
+
 int TaskHandler::handleListTask(const std::vector<std::string>& args) {
-    if (args.empty()) {
-        // List all task
-        printTask(TaskStatus::kUnknown);
-    } else {
-        std::string sub_cmd = args[0];
-        printTask(support_list_cmds[sub_cmd]);
+    ListQuery q;
+    if (!ParseListQuery(args, &q)) {
+        return 1;
+    }
+    bool ok = !loaded_ && q.Filtered() ? initFiltered(q) : load(false, 0);
+    if (!ok) {
+        return 1;
     }
+    printTask(q);
     return 0;
 }
 
-// +------+-------------+--------+--------------+--------------+
-// |  id  | description | status | created_time | updated_time |
-// +------+-------------+--------+--------------+--------------+
-void TaskHandler::printTask(TaskStatus status) {
-    char buffer[BUFFER_SIZE] = {0};
-    // Table head
-    printf("+------+-------------+---------+-------------------+-------------------+\n");
-    printf("|  id  | description |  status |    created_time   |    updated_time   |\n");
-    printf("+------+-------------+---------+-------------------+-------------------+\n");
-    if (status == TaskStatus::kDone) {
-        for (auto iter = task_done_.begin(); iter != task_done_.end(); ++iter) {
-            snprintf(buffer, BUFFER_SIZE, "%04d", std::stoi(iter->id));
-            printf("| %s |", buffer);
-            printf("    %s    |", iter->description.c_str());
-            printf("    %d    |", iter->status);
-            printf("%s|", iter->created_at.c_str());
-            printf("%s|\n", iter->updated_at.c_str());
-            printf("+------+-------------+---------+-------------------+-------------------+\n");
-        }
-    } else if (status == TaskStatus::kInProgress) {
-        for (auto iter = task_progress_.begin(); iter != task_progress_.end(); ++iter) {
-            snprintf(buffer, BUFFER_SIZE, "%04d", std::stoi(iter->id));
-            printf("| %s |", buffer);
-            printf("    %s    |", iter->description.c_str());
-            printf("    %d    |", iter->status);
-            printf("%s|", iter->created_at.c_str());
-            printf("%s|\n", iter->updated_at.c_str());
-            printf("+------+-------------+---------+-------------------+-------------------+\n");
-        }
-    } else if (status == TaskStatus::kTodo) {
-        for (auto iter = task_todo_.begin(); iter != task_todo_.end(); ++iter) {
-            snprintf(buffer, BUFFER_SIZE, "%04d", std::stoi(iter->id));
-            printf("| %s |", buffer);
-            printf("    %s    |", iter->description.c_str());
-            printf("    %d    |", iter->status);
-            printf("%s|", iter->created_at.c_str());
-            printf("%s|\n", iter->updated_at.c_str());
-            printf("+------+-------------+---------+-------------------+-------------------+\n");
+// search <terms> [OR <terms>] [--limit N] [--offset N] [--format F]
+int TaskHandler::handleSearch(const std::vector<std::string>& args) {
+    ListQuery q;
+    std::vector<std::string> words;
+    if (!ParseListQuery(args, &q, &words)) {
+        return 1;
+    }
+    SearchQuery query;
+    ErrRetIf(!ParseSearchQuery(words, &query), 1, "Missing search terms.");
+    Postings ids;
+    bool saved = false;
+    if (!text_index_ && !searchSaved(query, &ids, &saved)) {
+        return 1;
+    }
+    if (!text_index_ && !saved) {
+        // Nothing usable on disk, index every task and keep the index
+        if (!load(false, 0)) {
+            return 1;
+        }
+        buildTextIndex();
+        if (!updated_) {
+            saveTextIndex();
+        }
+    }
+    if (text_index_) {
+        const TextIndex* index = text_index_.get();
+        EvalQuery(query, [index](const std::string& term, Postings* out) {
+            const Postings* found = index->Find(term);
+            if (found) {
+                *out = *found;
+            }
+            return found != 0;
+        }, &ids);
+    }
+    // Candidates from the saved index may have changed since, check each
+    TaskRefs rows;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const Task* t = task_table_.Find(ids[i]);
+        if (t && MatchesQuery(query, t->description)) {
+            rows.push_back(t);
+        }
+    }
+    printTask(q, &rows);
+    return 0;
+}
+
+// Candidates for query from the saved index, found is left unset if there
+// is none for the current snapshot. It knows nothing of the log, so every
+// task changed since the snapshot is a candidate too and gets loaded with
+// the rest. False if loading failed.
+bool TaskHandler::searchSaved(const SearchQuery& query, Postings* ids, bool* found) {
+    struct stat st;
+    if (stat(storage_->Path().c_str(), &st) < 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    TextIndexFile f;
+    if (!TextIndexFileOpen(&f, termsPath(), st)) {
+        return true;
+    }
+    EvalQuery(query, [&f](const std::string& term, Postings* out) {
+        return TextIndexFileFind(&f, term, out);
+    }, ids);
+    TextIndexFileClose(&f);
+    bool ok = true;
+    if (partial_) {
+        ok = load(false, 0);
+    } else if (!loaded_ && !initSome(*ids, true)) {
+        ok = init();
+    }
+    if (!ok) {
+        return false;
+    }
+    Postings changed, merged;
+    dirty_.ForEach([&changed](TaskId id) {
+        changed.push_back(id);
+    });
+    UnionPostings(*ids, changed, &merged);
+    ids->swap(merged);
+    *found = true;
+    return true;
+}
+
+void TaskHandler::buildTextIndex() {
+    text_index_.reset(new TextIndex());
+    TextIndex* index = text_index_.get();
+    task_table_.ForEach([index](const Task& t) {
+        index->Add(t.id, t.description);
+    });
+}
+
+// Written for the snapshot on disk now. A failure only costs the next
+// search a rebuild, the old file no longer matches the snapshot anyway.
+void TaskHandler::saveTextIndex() {
+    if (!text_index_) {
+        buildTextIndex();
+    }
+    struct stat st;
+    if (stat(storage_->Path().c_str(), &st) < 0) {
+        memset(&st, 0, sizeof(st));
+    }
+    text_index_->Save(termsPath(), st);
+}
+
+void TaskHandler::reindex(TaskId id, const std::string& before, const std::string& after) {
+    if (text_index_) {
+        text_index_->Remove(id, before);
+        text_index_->Add(id, after);
+    }
+}
+
+// Write loaded tasks, log included, as a snapshot in the format the file
+// name asks for. Lets a store move between json and binary.
+int TaskHandler::handleConvert(const std::string& arg) {
+    std::unique_ptr<TaskStorage> target(CreateStorage(arg));
+    ErrRetIf(target->Path() == storage_->Path(), 1, "Refuse to convert %s onto itself.", arg.c_str());
+    ErrRetIf(!target->Save(allTasks()), 1, "Failed to write %s.", arg.c_str());
+    return 0;
+}
+
+// Batch over a file, "-" or no file reads stdin
+int TaskHandler::handleBatch(const std::vector<std::string>& args) {
+    if (args.empty() || args[0] == "-") {
+        return Batch(std::cin);
+    }
+    std::ifstream file(args[0].c_str());
+    ErrRetIf(!file, 1, "Failed to open %s.", args[0].c_str());
+    return Batch(file);
+}
+
+// Lines split like a shell would on blanks, with "..." and '...' quoting,
+// and blank or # lines are skipped. A failing line is reported on err_
+// and the rest still run, every change goes out in the one commit at exit.
+int TaskHandler::Batch(std::istream& in) {
+    if (!Load()) {
+        return 1;
+    }
+    std::string line;
+    std::vector<std::string> words;
+    int line_no = 0, done = 0, failed = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        int rc = 1;
+        if (!SplitCommandLine(line, &words)) {
+            ErrLast() = "Unterminated quote.";
+        } else if (words.empty() || words[0][0] == '#') {
+            continue;
+        } else {
+            std::string cmd = words[0];
+            words.erase(words.begin());
+            if (cmd == kBatchCmd || cmd == kServeCmd) {
+                ErrLast() = "Unsupport command: [" + cmd + "].";
+            } else if (CheckCommand(cmd, words.size())) {
+                rc = Handle(cmd, words);
+            }
+        }
+        if (rc) {
+            fprintf(err_, "line %d: %s\n", line_no, ErrLast().c_str());
+            failed++;
+        } else {
+            done++;
+        }
+    }
+    fprintf(err_, "batch: %d ok, %d failed\n", done, failed);
+    // Every failure is reported above already
+    ErrLast().clear();
+    return failed ? 1 : 0;
+}
+
+// Call fn with every task of rows, or of the table if rows is 0, that q
+// lists, in id order
+template <typename Fn>
+static void VisitRows(const TaskTable& table, const ListQuery& q, const TaskRefs* rows, Fn fn) {
+    auto visit = [&q, &fn](const Task& t) {
+        if (q.Match(t)) {
+            fn(t);
+        }
+    };
+    if (rows) {
+        for (size_t i = 0; i < rows->size(); ++i) {
+            visit(*(*rows)[i]);
         }
     } else {
-        for (auto iter = task_all_.begin(); iter != task_all_.end(); ++iter) {
-            snprintf(buffer, BUFFER_SIZE, "%04d", std::stoi(iter->id));
-            printf("| %s |", buffer);
-            printf("    %s    |", iter->description.c_str());
-            printf("    %d    |", iter->status);
-            printf("%s|", iter->created_at.c_str());
-            printf("%s|\n", iter->updated_at.c_str());
-            printf("+------+-------------+---------+-------------------+-------------------+\n");
+        table.ForEach(q.status, visit);
+    }
+}
+
+// The window of q in its sort order, found in one pass. A heap holds the
+// first offset + limit rows seen so far with the last of them on top, so
+// a row that does not beat it costs one comparison and the full set is
+// never sorted.
+static void SelectTop(const TaskTable& table, const ListQuery& q, const TaskRefs* rows, TaskRefs* out) {
+    auto before = [&q](const Task* a, const Task* b) {
+        return q.Before(a, b);
+    };
+    size_t keep = q.limit > SIZE_MAX - q.offset ? SIZE_MAX : q.offset + q.limit;
+    TaskRefs heap;
+    VisitRows(table, q, rows, [&heap, &before, keep](const Task& t) {
+        if (heap.size() < keep) {
+            heap.push_back(&t);
+            std::push_heap(heap.begin(), heap.end(), before);
+        } else if (keep > 0 && before(&t, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), before);
+            heap.back() = &t;
+            std::push_heap(heap.begin(), heap.end(), before);
+        }
+    });
+    std::sort_heap(heap.begin(), heap.end(), before);
+    out->assign(heap.begin() + std::min(q.offset, heap.size()), heap.end());
+}
+
+// Only rows inside the window of q are formatted. Machine readable
+// formats stream each row as it is visited, the table needs every row of
+// the window first to size its columns. Rows come from only if given,
+// from every task with the status of q otherwise.
+void TaskHandler::printTask(const ListQuery& q, const TaskRefs* only) {
+    TaskRefs rows;
+    std::unique_ptr<RecordWriter> stream;
+    if (q.format != ListFormat::kTable) {
+        stream.reset(new RecordWriter(out_, q.format));
+    }
+    auto emit = [&stream, &rows](const Task& t) {
+        if (stream) {
+            stream->Row(t);
+        } else {
+            rows.push_back(&t);
         }
+    };
+    if (q.sort != SortKey::kId || q.descending) {
+        TaskRefs top;
+        SelectTop(task_table_, q, only, &top);
+        for (size_t i = 0; i < top.size(); ++i) {
+            emit(*top[i]);
+        }
+    } else {
+        // Id order is the visiting order, rows go out as they come
+        size_t skip = q.offset;
+        size_t count = 0;
+        VisitRows(task_table_, q, only, [&](const Task& t) {
+            if (skip > 0) {
+                skip--;
+            } else if (count < q.limit) {
+                count++;
+                emit(t);
+            }
+        });
+    }
+    if (!stream) {
+        TableWriter writer(out_);
+        writer.Render(rows);
     }
-}
\ No newline at end of file
+}
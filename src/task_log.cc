@@ -0,0 +1,182 @@
+#include "task_log.hpp"
+#include "byte_codec.hpp"
+#include "task_time.hpp"
+#include "file_map.hpp"
+#include "durable_file.hpp"
+
+// Frame header, payload length and crc
+static const size_t kLogHeaderSize = 8;
+
+// Ids and times stay text in records, logs written before they became
+// integers replay unchanged
+static void EncodeRecord(std::string& out, LogOp op, const Task& t) {
+    out.push_back(static_cast<char>(op));
+    PutBytes(out, std::to_string(t.id));
+    if (op == LogOp::kAdd || op == LogOp::kUpdate) {
+        PutBytes(out, t.description);
+    }
+    if (op == LogOp::kAdd || op == LogOp::kMark) {
+        PutVarint(out, static_cast<uint32_t>(t.status));
+    }
+    if (op == LogOp::kAdd) {
+        PutBytes(out, FormatTaskTime(t.created_at));
+    }
+    if (op != LogOp::kDelete) {
+        PutBytes(out, FormatTaskTime(t.updated_at));
+    }
+}
+
+static bool DecodeRecord(const char* p, const char* end, LogRecord* r) {
+    uint64_t status = 0;
+    std::string id, time;
+    r->op = static_cast<LogOp>(*p++);
+    if (r->op < LogOp::kAdd || r->op > LogOp::kDelete) {
+        return false;
+    }
+    LogOp op = r->op;
+    if (!GetBytes(p, end, &id) || !ParseTaskId(id, &r->task.id)) {
+        return false;
+    }
+    if ((op == LogOp::kAdd || op == LogOp::kUpdate) && !GetBytes(p, end, &r->task.description)) {
+        return false;
+    }
+    if (op == LogOp::kAdd || op == LogOp::kMark) {
+        if (!GetVarint(p, end, &status)) {
+            return false;
+        }
+        r->task.status = static_cast<int>(static_cast<uint32_t>(status));
+    }
+    if (op == LogOp::kAdd && (!GetBytes(p, end, &time) || !ParseTaskTime(time, &r->task.created_at))) {
+        return false;
+    }
+    if (op != LogOp::kDelete && (!GetBytes(p, end, &time) || !ParseTaskTime(time, &r->task.updated_at))) {
+        return false;
+    }
+    return p == end;
+}
+
+TaskLog::TaskLog(const char* path, const CommitPolicy& policy)
+    : path_(path)
+    , policy_(policy)
+    , pending_records_(0)
+    , unsynced_(0)
+    , size_(0)
+    , fd_(-1)
+    , created_(false) {}
+
+TaskLog::~TaskLog() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool TaskLog::Replay(std::vector<LogRecord>& records) {
+    FileMap fm;
+    if (!FileMapOpen(&fm, path_.c_str())) {
+        return false;
+    }
+    const char* p = fm.data;
+    const char* end = fm.data + fm.size;
+    while ((size_t)(end - p) >= kLogHeaderSize) {
+        uint32_t len = GetFixed32(p);
+        uint32_t crc = GetFixed32(p + 4);
+        const char* payload = p + kLogHeaderSize;
+        if (len == 0 || len > (size_t)(end - payload) || Crc32(payload, len) != crc) {
+            break;
+        }
+        LogRecord r{};
+        if (!DecodeRecord(payload, payload + len, &r)) {
+            break;
+        }
+        records.push_back(std::move(r));
+        p = payload + len;
+    }
+    size_ = p - fm.data;
+    bool torn = size_ != fm.size;
+    FileMapClose(&fm);
+    if (torn) {
+        // Later appends must not land behind garbage
+        return truncate(path_.c_str(), size_) == 0;
+    }
+    return true;
+}
+
+void TaskLog::Append(LogOp op, const Task& t) {
+    std::string payload;
+    EncodeRecord(payload, op, t);
+    PutFixed32(pending_, payload.size());
+    PutFixed32(pending_, Crc32(payload.data(), payload.size()));
+    pending_.append(payload);
+    pending_records_++;
+}
+
+bool TaskLog::Commit() {
+    if (pending_.empty()) {
+        return true;
+    }
+    if (fd_ < 0) {
+        fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd_ < 0) {
+            return false;
+        }
+        struct stat st;
+        created_ = fstat(fd_, &st) == 0 && st.st_size == 0;
+    }
+    const char* p = pending_.data();
+    size_t left = pending_.size();
+    while (left > 0) {
+        ssize_t n = write(fd_, p, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    size_ += pending_.size();
+    unsynced_ += pending_records_;
+    pending_.clear();
+    pending_records_ = 0;
+    return true;
+}
+
+bool TaskLog::Sync() {
+    if (!unsynced_) {
+        return true;
+    }
+    if (policy_.delay_us > 0) {
+        usleep(policy_.delay_us);
+    }
+    // Another process that synced the file meanwhile leaves nothing dirty,
+    // the kernel then returns without a device flush
+    if (fdatasync(fd_) < 0) {
+        return false;
+    }
+    if (created_) {
+        if (!SyncParentDir(path_)) {
+            return false;
+        }
+        created_ = false;
+    }
+    unsynced_ = 0;
+    return true;
+}
+
+void TaskLog::Close() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    pending_.clear();
+    pending_records_ = 0;
+    unsynced_ = 0;
+    size_ = 0;
+    created_ = false;
+}
+
+bool TaskLog::Reset() {
+    Close();
+    return unlink(path_.c_str()) == 0 || errno == ENOENT;
+}
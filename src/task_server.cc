@@ -0,0 +1,293 @@
+#include "task_server.hpp"
+#include "byte_codec.hpp"
+#include <csignal>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const int kServeMaxEvents = 64;
+static const size_t kServeReadChunk = 64 * 1024;
+
+TaskServer::TaskServer(TaskHandler* handler)
+    : handler_(handler)
+    , epoll_fd_(-1)
+    , listen_fd_(-1)
+    , signal_fd_(-1)
+    , idle_pending_(false) {
+}
+
+TaskServer::~TaskServer() {
+    for (auto iter = clients_.begin(); iter != clients_.end(); ++iter) {
+        close(iter->first);
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+        unlink(path_.c_str());
+    }
+    if (signal_fd_ >= 0) {
+        close(signal_fd_);
+    }
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+    }
+}
+
+bool TaskServer::listen(const std::string& path) {
+    struct sockaddr_un addr = {};
+    ErrRetIf(path.size() >= sizeof(addr.sun_path), false, "Socket path too long: %s.", path.c_str());
+    int other = ServeConnect(path);
+    if (other >= 0) {
+        close(other);
+        ErrRetIf(true, false, "Already served at %s.", path.c_str());
+    }
+    // Left behind by a process that did not shut down cleanly
+    unlink(path.c_str());
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ErrRetIf(listen_fd_ < 0, false, "Failed to create socket.");
+    ErrRetIf(bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0, false,
+             "Failed to bind %s.", path.c_str());
+    path_ = path;
+    ErrRetIf(::listen(listen_fd_, SOMAXCONN) < 0, false, "Failed to listen on %s.", path.c_str());
+    return true;
+}
+
+int TaskServer::Run(const std::string& path) {
+    bool loaded = handler_->Load();
+    // Other processes may use the store between wakeups
+    handler_->Unlock();
+    if (!loaded || !listen(path)) {
+        return 1;
+    }
+    // Shutdown requests arrive as events, the loop can then finish cleanly
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, 0);
+    signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    ErrRetIf(signal_fd_ < 0 || epoll_fd_ < 0, 1, "Failed to set up event loop.");
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+    ev.data.fd = signal_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &ev);
+
+    struct epoll_event events[kServeMaxEvents];
+    bool running = true;
+    while (running) {
+        int n = epoll_wait(epoll_fd_, events, kServeMaxEvents, idle_pending_ ? kServeIdleMs : -1);
+        if (n < 0) {
+            ErrRetIf(errno != EINTR, 1, "Event loop failed.");
+            continue;
+        }
+        if (n == 0) {
+            // Nobody waits on this, the log simply stays until next time
+            if (!handler_->Compact()) {
+                fprintf(stderr, "%s\n", ErrLast().c_str());
+            }
+            handler_->Unlock();
+            idle_pending_ = false;
+            continue;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd_) {
+                accept();
+                continue;
+            }
+            if (fd == signal_fd_) {
+                running = false;
+                continue;
+            }
+            auto iter = clients_.find(fd);
+            if (iter == clients_.end()) {
+                continue;
+            }
+            Client* c = &iter->second;
+            bool ok = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ok = readClient(c);
+            }
+            if (ok && (events[i].events & EPOLLOUT)) {
+                ok = writeClient(c);
+            }
+            if (!ok) {
+                closeClient(c);
+            }
+        }
+        release();
+    }
+    bool ok = handler_->Compact();
+    handler_->Unlock();
+    return ok ? 0 : 1;
+}
+
+void TaskServer::accept() {
+    while (true) {
+        int fd = accept4(listen_fd_, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        Client& c = clients_[fd];
+        c.fd = fd;
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+bool TaskServer::readClient(Client* c) {
+    char chunk[kServeReadChunk];
+    bool hangup = false;
+    while (true) {
+        ssize_t n = recv(c->fd, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            c->in.append(chunk, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        hangup = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+    size_t p = 0;
+    while (c->in.size() - p >= kServeFrameHeader) {
+        uint32_t len = GetFixed32(c->in.data() + p);
+        if (len > kServeMaxFrame) {
+            return false;
+        }
+        if (c->in.size() - p - kServeFrameHeader < len) {
+            break;
+        }
+        const char* body = c->in.data() + p + kServeFrameHeader;
+        ServeRequest req;
+        if (!DecodeRequest(body, body + len, &req)) {
+            return false;
+        }
+        c->held.push_back(Held());
+        execute(req, &c->held.back().reply);
+        // Saw or made changes this wakeup has not committed yet
+        c->held.back().changed = handler_->HasChanges();
+        p += kServeFrameHeader + len;
+    }
+    c->in.erase(0, p);
+    // Requests read before the hangup still get their changes committed
+    return !hangup;
+}
+
+bool TaskServer::writeClient(Client* c) {
+    size_t p = 0;
+    while (p < c->out.size()) {
+        ssize_t n = send(c->fd, c->out.data() + p, c->out.size() - p, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        p += n;
+    }
+    c->out.erase(0, p);
+    watch(c);
+    return true;
+}
+
+// Ask for writability only while a reply is stuck in the socket
+void TaskServer::watch(Client* c) {
+    struct epoll_event ev = {};
+    ev.events = c->out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+    ev.data.fd = c->fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+void TaskServer::closeClient(Client* c) {
+    int fd = c->fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, 0);
+    close(fd);
+    clients_.erase(fd);
+}
+
+void TaskServer::execute(const ServeRequest& req, ServeReply* reply) {
+    char* out_buf = 0;
+    char* err_buf = 0;
+    size_t out_len = 0, err_len = 0;
+    FILE* out = open_memstream(&out_buf, &out_len);
+    FILE* err = open_memstream(&err_buf, &err_len);
+    ErrLast().clear();
+    reply->rc = 1;
+    if (!out || !err) {
+        ErrLast() = "Out of memory.";
+    } else if (req.words.empty()) {
+        ErrLast() = "Missing command.";
+    } else {
+        const std::string& cmd = req.words[0];
+        std::vector<std::string> args(req.words.begin() + 1, req.words.end());
+        handler_->SetOutput(out, err);
+        if (cmd == kServeCmd) {
+            ErrLast() = "Already serving.";
+        } else if (!CheckCommand(cmd, args.size())) {
+            // Message is in ErrLast
+        } else if (cmd == kBatchCmd) {
+            std::istringstream in(req.input);
+            reply->rc = handler_->Batch(in);
+        } else {
+            reply->rc = handler_->Handle(cmd, args);
+        }
+        handler_->SetOutput(stdout, stderr);
+    }
+    if (out) {
+        fclose(out);
+        reply->out.assign(out_buf, out_len);
+        free(out_buf);
+    }
+    if (err) {
+        fclose(err);
+        reply->err.assign(err_buf, err_len);
+        free(err_buf);
+    }
+    if (reply->rc && !ErrLast().empty()) {
+        reply->err += ErrLast() + "\n";
+    }
+}
+
+void TaskServer::release() {
+    if (handler_->HasChanges()) {
+        idle_pending_ = true;
+    }
+    // Commits, replies below then mean the change is on disk
+    ErrLast().clear();
+    bool committed = handler_->Unlock();
+    for (auto iter = clients_.begin(); iter != clients_.end();) {
+        Client* c = &iter->second;
+        ++iter;
+        if (c->held.empty()) {
+            continue;
+        }
+        for (size_t i = 0; i < c->held.size(); ++i) {
+            ServeReply& reply = c->held[i].reply;
+            if (!committed && c->held[i].changed) {
+                // The change is gone, and so is what later commands saw of it
+                reply.rc = 1;
+                reply.out.clear();
+                reply.err = ErrLast() + "\n";
+            }
+            EncodeReply(c->out, reply);
+        }
+        c->held.clear();
+        if (!writeClient(c)) {
+            closeClient(c);
+        }
+    }
+}
@@ -0,0 +1,421 @@
+#include "task_storage.hpp"
+#include "task_schema.hpp"
+#include "task_time.hpp"
+#include "byte_codec.hpp"
+#include "file_map.hpp"
+#include "durable_file.hpp"
+#include <algorithm>
+
+static const char kBinaryMagic[4] = { 'T', 'T', 'C', 'B' };
+static const uint32_t kBinaryVersion = 1;
+static const size_t kBinaryHeaderSize = 32;
+
+static const char kIndexMagic[4] = { 'T', 'T', 'C', 'I' };
+static const uint32_t kIndexVersion = 1;
+static const size_t kIndexHeaderSize = 40;
+static const size_t kIndexEntrySize = 16;
+
+// Record flags, the field is a heap offset instead of an inline value.
+// Times before 1970 have no varint form and are written there as text,
+// snapshots from older versions may also hold times that do not parse.
+static const uint8_t kHeapId      = 0x01;
+static const uint8_t kHeapCreated = 0x02;
+static const uint8_t kHeapUpdated = 0x04;
+
+// Replace path with the concatenation of parts
+static bool WriteParts(const std::string& path, const std::string* const* parts, int count) {
+    AtomicFile af;
+    if (!AtomicFileOpen(&af, path)) {
+        return false;
+    }
+    struct iovec iov[4];
+    for (int i = 0; i < count; ++i) {
+        iov[i].iov_base = const_cast<char*>(parts[i]->data());
+        iov[i].iov_len = parts[i]->size();
+    }
+    return AtomicFileCommit(&af, WriteAll(af.fd, iov, count));
+}
+
+// Collects records keep accepts
+struct KeepContext {
+    std::vector<Task>* tasks;
+    const TaskKeep* keep;
+};
+
+static bool KeepTask(void* ctx, const Task& t) {
+    return (*static_cast<KeepContext*>(ctx)->keep)(t);
+}
+
+static bool OnKeptTask(void* ctx, Task& t) {
+    static_cast<KeepContext*>(ctx)->tasks->push_back(std::move(t));
+    return true;
+}
+
+bool JsonStorage::Load(std::vector<Task>& tasks, size_t* bytes, const TaskKeep& keep) {
+    FileMap fm;
+    if (!FileMapOpen(&fm, path_.c_str())) {
+        return false;
+    }
+    bool ok = true;
+    // Missing, empty or blank file is an empty task list
+    if (*skip(fm.data)) {
+        // Fill tasks from the mapping through the Task schema, no copy and no tree
+        if (keep) {
+            KeepContext ctx = { &tasks, &keep };
+            // Only kept tasks get their description decoded, see TaskKeep
+            ok = HJson_readRecords<Task>(fm.data, OnKeptTask, &ctx, KeepTask, "description");
+        } else {
+            ok = HJson_readRecords(fm.data, tasks);
+        }
+    }
+    *bytes = fm.size;
+    FileMapClose(&fm);
+    return ok;
+}
+
+// Sidecar mapped and matched against the json file it was written for
+struct JsonIndex {
+    FileMap fm;
+    uint32_t count;
+};
+
+static bool IndexOpen(JsonIndex* idx, const std::string& path, const struct stat& st) {
+    if (!FileMapOpen(&idx->fm, path.c_str())) {
+        return false;
+    }
+    const char* p = idx->fm.data;
+    bool ok = idx->fm.size >= kIndexHeaderSize
+        && !memcmp(p, kIndexMagic, 4)
+        && GetFixed32(p + 4) == kIndexVersion
+        && GetFixed64(p + 8) == (uint64_t)st.st_size
+        && GetFixed64(p + 16) == (uint64_t)st.st_mtim.tv_sec
+        && GetFixed64(p + 24) == (uint64_t)st.st_mtim.tv_nsec;
+    if (ok) {
+        idx->count = GetFixed32(p + 32);
+        ok = idx->fm.size == kIndexHeaderSize + (uint64_t)idx->count * kIndexEntrySize;
+    }
+    if (!ok) {
+        FileMapClose(&idx->fm);
+    }
+    return ok;
+}
+
+// Byte range of id, false if the index has no such record
+static bool IndexFind(const JsonIndex* idx, TaskId id, uint64_t* offset, uint32_t* length) {
+    const char* entries = idx->fm.data + kIndexHeaderSize;
+    uint32_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char* e = entries + (size_t)mid * kIndexEntrySize;
+        TaskId mid_id = GetFixed32(e);
+        if (mid_id == id) {
+            *length = GetFixed32(e + 4);
+            *offset = GetFixed64(e + 8);
+            return *offset + *length <= GetFixed64(idx->fm.data + 8);
+        }
+        if (mid_id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+static bool IndexWrite(const std::string& path, const struct stat& st,
+                       std::vector<JsonIndexEntry>& entries) {
+    std::sort(entries.begin(), entries.end(),
+              [](const JsonIndexEntry& a, const JsonIndexEntry& b) { return a.id < b.id; });
+    std::string out(kIndexMagic, 4);
+    out.reserve(kIndexHeaderSize + entries.size() * kIndexEntrySize);
+    PutFixed32(out, kIndexVersion);
+    PutFixed64(out, st.st_size);
+    PutFixed64(out, st.st_mtim.tv_sec);
+    PutFixed64(out, st.st_mtim.tv_nsec);
+    PutFixed32(out, entries.size());
+    PutFixed32(out, 0);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        PutFixed32(out, entries[i].id);
+        PutFixed32(out, entries[i].length);
+        PutFixed64(out, entries[i].offset);
+    }
+    const std::string* parts[1] = { &out };
+    return WriteParts(path, parts, 1);
+}
+
+// Write tasks as a json array and note the byte range of each record.
+// With an index, tasks not in dirty are copied from old byte for byte.
+static void WriteTasks(HJson_buffer* buf, const TaskRefs& tasks, const IdSet* dirty,
+                       const char* old, const JsonIndex* idx,
+                       std::vector<JsonIndexEntry>* entries) {
+    HJson_putc(buf, '[');
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const Task& t = *tasks[i];
+        if (i) {
+            HJson_putc(buf, ',');
+        }
+        uint64_t begin = HJson_bufferTell(buf);
+        uint64_t offset;
+        uint32_t length;
+        if (idx && !dirty->Test(t.id) && IndexFind(idx, t.id, &offset, &length)) {
+            HJson_append(buf, old + offset, length);
+        } else {
+            HJson_writeRecord(buf, t);
+        }
+        if (entries) {
+            JsonIndexEntry e = { t.id, (uint32_t)(HJson_bufferTell(buf) - begin), begin };
+            entries->push_back(e);
+        }
+    }
+    HJson_putc(buf, ']');
+}
+
+bool JsonStorage::Write(int fd, const TaskRefs& tasks) {
+    HJson_buffer buf;
+    if (!HJson_bufferOpen(&buf, fd)) {
+        return false;
+    }
+    WriteTasks(&buf, tasks, 0, 0, 0, 0);
+    return HJson_bufferClose(&buf);
+}
+
+static bool OnSingleTask(void* ctx, Task& t) {
+    *static_cast<Task*>(ctx) = std::move(t);
+    return true;
+}
+
+bool JsonStorage::LoadSome(const std::vector<TaskId>& ids, std::vector<Task>& tasks, size_t* bytes) {
+    struct stat st;
+    if (stat(path_.c_str(), &st) < 0) {
+        *bytes = 0;
+        return errno == ENOENT;
+    }
+    *bytes = st.st_size;
+    JsonIndex idx;
+    if (!IndexOpen(&idx, indexPath(), st)) {
+        return false;
+    }
+    int fd = open(path_.c_str(), O_RDONLY);
+    bool ok = fd >= 0;
+    std::string text;
+    for (size_t i = 0; i < ids.size() && ok; ++i) {
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        if (!IndexFind(&idx, ids[i], &offset, &length)) {
+            continue;
+        }
+        // Read and parse only the record's own bytes
+        text.assign(length, '\0');
+        ok = pread(fd, &text[0], length, offset) == (ssize_t)length;
+        Task one{};
+        ok = ok && HJson_readRecords<Task>(text.c_str(), OnSingleTask, &one, 1);
+        // A record that is not the one asked for means the index lies
+        ok = ok && one.id == ids[i];
+        if (ok) {
+            tasks.push_back(std::move(one));
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    FileMapClose(&idx.fm);
+    return ok;
+}
+
+bool JsonStorage::Save(const TaskRefs& tasks, const IdSet* dirty) {
+    // Clean records can be spliced from the current snapshot when its
+    // index still describes it
+    FileMap old = { "", 0, 0 };
+    JsonIndex idx;
+    bool splice = false;
+    struct stat st;
+    if (dirty && stat(path_.c_str(), &st) == 0 && IndexOpen(&idx, indexPath(), st)) {
+        splice = FileMapOpen(&old, path_.c_str()) && old.size == (size_t)st.st_size;
+        if (!splice) {
+            FileMapClose(&idx.fm);
+            FileMapClose(&old);
+        }
+    }
+    // Stream to a temp file, no in-memory copy of the document
+    std::vector<JsonIndexEntry> entries;
+    entries.reserve(tasks.size());
+    AtomicFile af;
+    bool ok = AtomicFileOpen(&af, path_);
+    if (ok) {
+        HJson_buffer buf;
+        ok = HJson_bufferOpen(&buf, af.fd);
+        if (ok) {
+            WriteTasks(&buf, tasks, dirty, old.data, splice ? &idx : 0, &entries);
+            ok = HJson_bufferClose(&buf);
+        }
+        ok = AtomicFileCommit(&af, ok);
+    }
+    if (splice) {
+        FileMapClose(&idx.fm);
+        FileMapClose(&old);
+    }
+    if (!ok) {
+        return false;
+    }
+    // The index is only a cache, without it point loads read everything
+    if (stat(path_.c_str(), &st) < 0 || !IndexWrite(indexPath(), st, entries)) {
+        unlink(indexPath().c_str());
+    }
+    return true;
+}
+
+// Heap string at offset
+static bool GetHeapString(const char* heap, uint64_t heap_size, uint64_t offset, std::string* s) {
+    if (offset >= heap_size) {
+        return false;
+    }
+    const char* p = heap + offset;
+    return GetBytes(p, heap + heap_size, s);
+}
+
+bool BinaryStorage::Load(std::vector<Task>& tasks, size_t* bytes, const TaskKeep& keep) {
+    FileMap fm;
+    if (!FileMapOpen(&fm, path_.c_str())) {
+        return false;
+    }
+    *bytes = fm.size;
+    if (!fm.size) {
+        FileMapClose(&fm);
+        return true;
+    }
+    bool ok = false;
+    const char* data = fm.data;
+    do {
+        if (fm.size < kBinaryHeaderSize || memcmp(data, kBinaryMagic, 4)
+            || GetFixed32(data + 4) != kBinaryVersion) {
+            break;
+        }
+        uint32_t count = GetFixed32(data + 8);
+        uint32_t crc = GetFixed32(data + 12);
+        uint64_t records_size = GetFixed64(data + 16);
+        uint64_t heap_size = GetFixed64(data + 24);
+        uint64_t body_size = fm.size - kBinaryHeaderSize;
+        if (records_size > body_size || heap_size != body_size - records_size
+            || Crc32(data + kBinaryHeaderSize, body_size) != crc) {
+            break;
+        }
+        const char* p = data + kBinaryHeaderSize;
+        const char* end = p + records_size;
+        const char* heap = end;
+        if (!keep) {
+            tasks.reserve(tasks.size() + count);
+        }
+        uint32_t i = 0;
+        for (; i < count; ++i) {
+            uint64_t id, status, created, updated, description;
+            if (!GetVarint(p, end, &id) || !GetVarint(p, end, &status) || p >= end) {
+                break;
+            }
+            uint8_t flags = (uint8_t)*p++;
+            if (!GetVarint(p, end, &created) || !GetVarint(p, end, &updated)
+                || !GetVarint(p, end, &description)) {
+                break;
+            }
+            Task t{};
+            t.status = static_cast<int>(static_cast<uint32_t>(status));
+            std::string text;
+            if (flags & kHeapId) {
+                // Written before ids were integers, the text must still be one
+                if (!GetHeapString(heap, heap_size, id, &text) || !ParseTaskId(text, &t.id)) {
+                    break;
+                }
+            } else if (id == 0 || id > kMaxTaskId) {
+                break;
+            } else {
+                t.id = static_cast<TaskId>(id);
+            }
+            // Times that did not parse when written stay text in the heap
+            if (flags & kHeapCreated) {
+                if (!GetHeapString(heap, heap_size, created, &text)) {
+                    break;
+                }
+                t.created_at = ReadStoredTaskTime(text.data(), text.size());
+            } else if (created > (uint64_t)kMaxTaskTime) {
+                break;
+            } else {
+                t.created_at = (TaskTime)created;
+            }
+            if (flags & kHeapUpdated) {
+                if (!GetHeapString(heap, heap_size, updated, &text)) {
+                    break;
+                }
+                t.updated_at = ReadStoredTaskTime(text.data(), text.size());
+            } else if (updated > (uint64_t)kMaxTaskTime) {
+                break;
+            } else {
+                t.updated_at = (TaskTime)updated;
+            }
+            if (keep && !keep(t)) {
+                continue;
+            }
+            if (!GetHeapString(heap, heap_size, description, &t.description)) {
+                break;
+            }
+            tasks.push_back(std::move(t));
+        }
+        ok = i == count && p == end;
+    } while (false);
+    FileMapClose(&fm);
+    return ok;
+}
+
+// Append s to heap, return its offset
+static uint64_t PutHeapString(std::string& heap, const std::string& s) {
+    uint64_t offset = heap.size();
+    PutBytes(heap, s);
+    return offset;
+}
+
+bool BinaryStorage::Save(const TaskRefs& tasks, const IdSet* /*dirty*/) {
+    std::string records;
+    std::string heap;
+    records.reserve(tasks.size() * 16);
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        const Task& t = *tasks[i];
+        PutVarint(records, t.id);
+        PutVarint(records, static_cast<uint32_t>(t.status));
+        uint8_t flags = 0;
+        uint64_t created = t.created_at;
+        uint64_t updated = t.updated_at;
+        if (t.created_at < 0) {
+            flags |= kHeapCreated;
+            created = PutHeapString(heap, FormatTaskTime(t.created_at));
+        }
+        if (t.updated_at < 0) {
+            flags |= kHeapUpdated;
+            updated = PutHeapString(heap, FormatTaskTime(t.updated_at));
+        }
+        records.push_back(flags);
+        PutVarint(records, created);
+        PutVarint(records, updated);
+        PutVarint(records, PutHeapString(heap, t.description));
+    }
+    std::string header(kBinaryMagic, 4);
+    uint32_t crc = Crc32Update(Crc32(records.data(), records.size()), heap.data(), heap.size());
+    PutFixed32(header, kBinaryVersion);
+    PutFixed32(header, tasks.size());
+    PutFixed32(header, crc);
+    PutFixed64(header, records.size());
+    PutFixed64(header, heap.size());
+    const std::string* parts[3] = { &header, &records, &heap };
+    return WriteParts(path_, parts, 3);
+}
+
+TaskStorage* CreateStorage(StorageKind kind, const std::string& path) {
+    if (kind == StorageKind::kBinary) {
+        return new BinaryStorage(path);
+    }
+    return new JsonStorage(path);
+}
+
+TaskStorage* CreateStorage(const std::string& path) {
+    const std::string ext = ".json";
+    bool json = path.size() >= ext.size()
+        && !path.compare(path.size() - ext.size(), ext.size(), ext);
+    return CreateStorage(json ? StorageKind::kJson : StorageKind::kBinary, path);
+}
@@ -0,0 +1,84 @@
+#include "task_table.hpp"
+
+uint32_t* TaskTable::slot(TaskId id) {
+    if (id == 0 || id > kMaxTaskId) {
+        return 0;
+    }
+    if (id >= slots_.size()) {
+        slots_.resize((size_t)id + 1, 0);
+    }
+    return &slots_[id];
+}
+
+void TaskTable::index(TaskId id, int status, bool set) {
+    int i = statusIndex(status);
+    if (i < 0) {
+        return;
+    }
+    if (set) {
+        status_ids_[i].Set(id);
+    } else {
+        status_ids_[i].Clear(id);
+    }
+}
+
+void TaskTable::SetStatus(Task* t, int status) {
+    index(t->id, t->status, false);
+    t->status = status;
+    index(t->id, t->status, true);
+}
+
+Task* TaskTable::Find(TaskId id) {
+    if (id >= slots_.size() || !slots_[id]) {
+        return 0;
+    }
+    return &tasks_[slots_[id] - 1];
+}
+
+bool TaskTable::Put(const Task& t) {
+    return Put(Task(t));
+}
+
+bool TaskTable::Put(Task&& t) {
+    uint32_t* s = slot(t.id);
+    if (!s) {
+        return false;
+    }
+    if (t.id >= next_id_) {
+        next_id_ = t.id + 1;
+    }
+    index(t.id, t.status, true);
+    if (*s) {
+        Task& old = tasks_[*s - 1];
+        if (old.status != t.status) {
+            index(t.id, old.status, false);
+        }
+        old = std::move(t);
+    } else {
+        tasks_.push_back(std::move(t));
+        *s = tasks_.size();
+    }
+    return true;
+}
+
+bool TaskTable::Erase(TaskId id) {
+    // A deleted id is never handed out again, even one replayed from a
+    // log after its task left the snapshot
+    if (id >= next_id_ && id <= kMaxTaskId) {
+        next_id_ = id + 1;
+    }
+    Task* t = Find(id);
+    if (!t) {
+        return false;
+    }
+    index(id, t->status, false);
+    // Fill the hole with the last task, keeps tasks_ packed
+    uint32_t at = slots_[id] - 1;
+    if (at + 1 != tasks_.size()) {
+        tasks_[at] = std::move(tasks_.back());
+        slots_[tasks_[at].id] = at + 1;
+    }
+    tasks_.pop_back();
+    slots_[id] = 0;
+    return true;
+}
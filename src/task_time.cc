@@ -0,0 +1,128 @@
+#include "task_time.hpp"
+#include <cstring>
+#include <ctime>
+
+static const TaskTime kDaySeconds = 86400;
+// Zone offsets and the instants they change at are multiples of this
+static const time_t kZoneQuantum = 900;
+
+static size_t unknown_times = 0;
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t DaysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void CivilFromDays(int64_t z, int64_t* y, unsigned* m, unsigned* d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static bool ReadDigits(const char* p, int n, unsigned* v) {
+    *v = 0;
+    for (int i = 0; i < n; ++i) {
+        if (p[i] < '0' || p[i] > '9') {
+            return false;
+        }
+        *v = *v * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+static void PutDigits(char* p, unsigned v, int n) {
+    for (int i = n - 1; i >= 0; --i) {
+        p[i] = (char)('0' + v % 10);
+        v /= 10;
+    }
+}
+
+bool ParseTaskTime(const char* p, size_t len, TaskTime* t) {
+    unsigned y, mo, d, h, mi, se;
+    if (len != kTaskTimeLen || p[4] != '-' || p[7] != '-' || p[10] != ' ' || p[13] != ':' || p[16] != ':') {
+        return false;
+    }
+    if (!ReadDigits(p, 4, &y) || !ReadDigits(p + 5, 2, &mo) || !ReadDigits(p + 8, 2, &d)
+        || !ReadDigits(p + 11, 2, &h) || !ReadDigits(p + 14, 2, &mi) || !ReadDigits(p + 17, 2, &se)) {
+        return false;
+    }
+    if (mo < 1 || mo > 12 || d < 1 || d > 31 || h > 23 || mi > 59 || se > 59) {
+        return false;
+    }
+    int64_t days = DaysFromCivil(y, mo, d);
+    // Reject dates like 02-31 that would not format back the same
+    int64_t cy;
+    unsigned cm, cd;
+    CivilFromDays(days, &cy, &cm, &cd);
+    if (cm != mo || cd != d) {
+        return false;
+    }
+    *t = days * kDaySeconds + h * 3600 + mi * 60 + se;
+    return true;
+}
+
+TaskTime ReadStoredTaskTime(const char* str, size_t len) {
+    TaskTime t;
+    if (!ParseTaskTime(str, len, &t)) {
+        unknown_times++;
+        return kUnknownTaskTime;
+    }
+    return t;
+}
+
+size_t UnknownTaskTimes() {
+    return unknown_times;
+}
+
+void FormatTaskTime(TaskTime t, char* out) {
+    // Listings and snapshots hold long runs of times from one day
+    static int64_t cached_day = -1;
+    static char cached_date[11];
+    // Floored, times before 1970 are negative
+    int64_t day = t / kDaySeconds - (t % kDaySeconds < 0);
+    unsigned rem = (unsigned)(t - day * kDaySeconds);
+    if (day != cached_day) {
+        int64_t y;
+        unsigned m, d;
+        CivilFromDays(day, &y, &m, &d);
+        PutDigits(cached_date, (unsigned)y, 4);
+        cached_date[4] = '-';
+        PutDigits(cached_date + 5, m, 2);
+        cached_date[7] = '-';
+        PutDigits(cached_date + 8, d, 2);
+        cached_date[10] = ' ';
+        cached_day = day;
+    }
+    memcpy(out, cached_date, sizeof(cached_date));
+    PutDigits(out + 11, rem / 3600, 2);
+    out[13] = ':';
+    PutDigits(out + 14, rem / 60 % 60, 2);
+    out[16] = ':';
+    PutDigits(out + 17, rem % 60, 2);
+}
+
+TaskTime TaskTimeNow() {
+    static time_t zone_from = 1;
+    static time_t zone_to = 0;
+    static long zone_offset = 0;
+    time_t now = time(0);
+    if (now < zone_from || now >= zone_to) {
+        struct tm local;
+        localtime_r(&now, &local);
+        zone_offset = local.tm_gmtoff;
+        zone_from = now - now % kZoneQuantum;
+        zone_to = zone_from + kZoneQuantum;
+    }
+    return (TaskTime)now + zone_offset;
+}
@@ -0,0 +1,266 @@
+#include "text_index.hpp"
+#include "byte_codec.hpp"
+#include "durable_file.hpp"
+
+static const char kTermsMagic[4] = { 'T', 'T', 'C', 'T' };
+static const uint32_t kTermsVersion = 1;
+static const size_t kTermsHeaderSize = 40;
+static const size_t kTermsEntrySize = 16;
+
+static bool IsTermByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+void Tokenize(const std::string& text, std::vector<std::string>* terms) {
+    terms->clear();
+    size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && !IsTermByte(text[i])) {
+            i++;
+        }
+        size_t begin = i;
+        while (i < text.size() && IsTermByte(text[i])) {
+            i++;
+        }
+        if (begin == i) {
+            break;
+        }
+        std::string term = text.substr(begin, i - begin);
+        for (size_t k = 0; k < term.size(); ++k) {
+            if (term[k] >= 'A' && term[k] <= 'Z') {
+                term[k] += 'a' - 'A';
+            }
+        }
+        // Descriptions are short, a linear scan beats a set
+        if (std::find(terms->begin(), terms->end(), term) == terms->end()) {
+            terms->push_back(std::move(term));
+        }
+    }
+}
+
+bool ParseSearchQuery(const std::vector<std::string>& words, SearchQuery* query) {
+    std::vector<std::string> terms;
+    query->assign(1, std::vector<std::string>());
+    for (size_t i = 0; i < words.size(); ++i) {
+        if (words[i] == "OR") {
+            query->emplace_back();
+            continue;
+        }
+        Tokenize(words[i], &terms);
+        query->back().insert(query->back().end(), terms.begin(), terms.end());
+    }
+    for (size_t g = 0; g < query->size(); ++g) {
+        if ((*query)[g].empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MatchesQuery(const SearchQuery& query, const std::string& text) {
+    std::vector<std::string> terms;
+    Tokenize(text, &terms);
+    for (size_t g = 0; g < query.size(); ++g) {
+        bool all = true;
+        for (size_t i = 0; i < query[g].size() && all; ++i) {
+            all = std::find(terms.begin(), terms.end(), query[g][i]) != terms.end();
+        }
+        if (all) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// First position at or after lo whose id is not below id. Steps double
+// until they pass id, then a binary search covers the last step.
+static size_t Gallop(const Postings& list, size_t lo, TaskId id) {
+    size_t step = 1;
+    size_t hi = lo;
+    while (hi < list.size() && list[hi] < id) {
+        lo = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = std::min(hi, list.size());
+    return std::lower_bound(list.begin() + lo, list.begin() + hi, id) - list.begin();
+}
+
+void IntersectPostings(const Postings& a, const Postings& b, Postings* out) {
+    const Postings& small = a.size() <= b.size() ? a : b;
+    const Postings& large = a.size() <= b.size() ? b : a;
+    out->clear();
+    size_t pos = 0;
+    for (size_t i = 0; i < small.size() && pos < large.size(); ++i) {
+        pos = Gallop(large, pos, small[i]);
+        if (pos < large.size() && large[pos] == small[i]) {
+            out->push_back(small[i]);
+        }
+    }
+}
+
+void UnionPostings(const Postings& a, const Postings& b, Postings* out) {
+    out->clear();
+    out->reserve(a.size() + b.size());
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(*out));
+}
+
+void TextIndex::Add(TaskId id, const std::string& text) {
+    std::vector<std::string> terms;
+    Tokenize(text, &terms);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        Postings& list = postings_[terms[i]];
+        // New tasks get the highest id so far, that append is the usual case
+        if (list.empty() || list.back() < id) {
+            list.push_back(id);
+            continue;
+        }
+        auto iter = std::lower_bound(list.begin(), list.end(), id);
+        if (*iter != id) {
+            list.insert(iter, id);
+        }
+    }
+}
+
+void TextIndex::Remove(TaskId id, const std::string& text) {
+    std::vector<std::string> terms;
+    Tokenize(text, &terms);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        auto found = postings_.find(terms[i]);
+        if (found == postings_.end()) {
+            continue;
+        }
+        Postings& list = found->second;
+        auto iter = std::lower_bound(list.begin(), list.end(), id);
+        if (iter != list.end() && *iter == id) {
+            list.erase(iter);
+        }
+        if (list.empty()) {
+            postings_.erase(found);
+        }
+    }
+}
+
+const Postings* TextIndex::Find(const std::string& term) const {
+    auto iter = postings_.find(term);
+    return iter == postings_.end() ? 0 : &iter->second;
+}
+
+bool TextIndex::Save(const std::string& path, const struct stat& snapshot) const {
+    typedef std::unordered_map<std::string, Postings>::const_iterator Entry;
+    std::vector<Entry> entries;
+    entries.reserve(postings_.size());
+    for (Entry iter = postings_.begin(); iter != postings_.end(); ++iter) {
+        entries.push_back(iter);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) { return a->first < b->first; });
+    std::string header(kTermsMagic, 4);
+    PutFixed32(header, kTermsVersion);
+    PutFixed64(header, snapshot.st_size);
+    PutFixed64(header, snapshot.st_mtim.tv_sec);
+    PutFixed64(header, snapshot.st_mtim.tv_nsec);
+    PutFixed32(header, entries.size());
+    PutFixed32(header, 0);
+    uint64_t text_base = kTermsHeaderSize + entries.size() * kTermsEntrySize;
+    uint64_t postings_base = text_base;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        postings_base += entries[i]->first.size();
+    }
+    std::string table, text, postings;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const std::string& term = entries[i]->first;
+        const Postings& list = entries[i]->second;
+        PutFixed32(table, text_base + text.size());
+        PutFixed32(table, term.size());
+        PutFixed32(table, postings_base + postings.size());
+        PutFixed32(table, list.size());
+        text.append(term);
+        TaskId prev = 0;
+        for (size_t k = 0; k < list.size(); ++k) {
+            PutVarint(postings, list[k] - prev);
+            prev = list[k];
+        }
+    }
+    if (postings_base + postings.size() > UINT32_MAX) {
+        return false;
+    }
+    AtomicFile af;
+    if (!AtomicFileOpen(&af, path)) {
+        return false;
+    }
+    struct iovec iov[4] = {
+        { &header[0], header.size() },
+        { &table[0], table.size() },
+        { &text[0], text.size() },
+        { &postings[0], postings.size() }
+    };
+    // One writev for the whole file, short writes resume where they stopped
+    return AtomicFileCommit(&af, WriteAll(af.fd, iov, 4));
+}
+
+bool TextIndexFileOpen(TextIndexFile* f, const std::string& path, const struct stat& snapshot) {
+    if (!FileMapOpen(&f->fm, path.c_str())) {
+        return false;
+    }
+    const char* p = f->fm.data;
+    bool ok = f->fm.size >= kTermsHeaderSize
+        && !memcmp(p, kTermsMagic, 4)
+        && GetFixed32(p + 4) == kTermsVersion
+        && GetFixed64(p + 8) == (uint64_t)snapshot.st_size
+        && GetFixed64(p + 16) == (uint64_t)snapshot.st_mtim.tv_sec
+        && GetFixed64(p + 24) == (uint64_t)snapshot.st_mtim.tv_nsec;
+    if (ok) {
+        f->count = GetFixed32(p + 32);
+        ok = f->fm.size >= kTermsHeaderSize + (uint64_t)f->count * kTermsEntrySize;
+    }
+    if (!ok) {
+        FileMapClose(&f->fm);
+    }
+    return ok;
+}
+
+bool TextIndexFileFind(const TextIndexFile* f, const std::string& term, Postings* ids) {
+    const char* base = f->fm.data;
+    const char* entries = base + kTermsHeaderSize;
+    uint32_t lo = 0, hi = f->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char* e = entries + (size_t)mid * kTermsEntrySize;
+        uint32_t text_off = GetFixed32(e);
+        uint32_t text_len = GetFixed32(e + 4);
+        if ((uint64_t)text_off + text_len > f->fm.size) {
+            return false;
+        }
+        int cmp = term.compare(0, std::string::npos, base + text_off, text_len);
+        if (cmp > 0) {
+            lo = mid + 1;
+        } else if (cmp < 0) {
+            hi = mid;
+        } else {
+            uint32_t post_off = GetFixed32(e + 8);
+            uint32_t count = GetFixed32(e + 12);
+            if (post_off > f->fm.size) {
+                return false;
+            }
+            const char* p = base + post_off;
+            const char* end = base + f->fm.size;
+            ids->resize(count);
+            uint64_t id = 0;
+            for (uint32_t k = 0; k < count; ++k) {
+                uint64_t gap = 0;
+                if (!GetVarint(p, end, &gap)) {
+                    return false;
+                }
+                id += gap;
+                (*ids)[k] = static_cast<TaskId>(id);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void TextIndexFileClose(TextIndexFile* f) {
+    FileMapClose(&f->fm);
+}
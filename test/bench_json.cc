@@ -0,0 +1,104 @@
+#include "hjson.hpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using BenchClock = std::chrono::steady_clock;
+
+static const int kBenchRounds = 50;
+
+// Run fn over text for kBenchRounds and report bytes/sec
+template <typename Fn>
+static void BenchBytes(const char* name, const std::string& text, Fn fn) {
+    size_t sink = 0;
+    BenchClock::time_point begin = BenchClock::now();
+    for (int i = 0; i < kBenchRounds; ++i) {
+        sink += fn(text.c_str());
+    }
+    std::chrono::duration<double> elapsed = BenchClock::now() - begin;
+    double mb = (double)text.size() * kBenchRounds / (1024.0 * 1024.0);
+    printf("%-24s %10.1f MB/s (%zu)\n", name, mb / elapsed.count(), sink);
+}
+
+// Walk whole text with a skip kernel, hopping over each non blank byte
+template <HJson_scanFn Skip>
+static size_t WalkSkip(const char* p) {
+    size_t n = 0;
+    while (*(p = Skip(p))) {
+        p++;
+        n++;
+    }
+    return n;
+}
+
+// Walk whole text with a string kernel, hopping over each terminator
+template <HJson_scanFn Scan>
+static size_t WalkString(const char* p) {
+    size_t n = 0;
+    while (*(p = Scan(p))) {
+        p++;
+        n++;
+    }
+    return n;
+}
+
+static size_t ParseDocument(const char* p) {
+    HJson_arena arena = {};
+    HJson* root_node = HJson_parse(p, &arena);
+    size_t ok = root_node ? 1 : 0;
+    HJson_arenaRelease(&arena);
+    return ok;
+}
+
+static size_t ParseEvents(const char* p) {
+    HJson_handler handler = {};
+    return HJson_parseEvents(p, &handler, 0) ? 1 : 0;
+}
+
+// Indented task array with long descriptions
+static std::string MakeTaskDocument(int count) {
+    std::string doc = "[\n";
+    std::string description(200, 'x');
+    for (int i = 1; i <= count; ++i) {
+        doc += "    {\n";
+        doc += "        \"id\": \"" + std::to_string(i) + "\",\n";
+        doc += "        \"description\": \"" + description + "\",\n";
+        doc += "        \"status\": 0,\n";
+        doc += "        \"created_at\": \"2024-01-01 00:00:00\",\n";
+        doc += "        \"updated_at\": \"2024-01-01 00:00:00\"\n";
+        doc += i == count ? "    }\n" : "    },\n";
+    }
+    doc += "]";
+    return doc;
+}
+
+int main(int argc, char const *argv[])
+{
+    std::string blanks;
+    for (int i = 0; i < 1 << 16; ++i) {
+        blanks += std::string(i % 64, ' ') + '\n' + "\t{";
+    }
+    std::string strings;
+    for (int i = 0; i < 1 << 14; ++i) {
+        strings += std::string(100 + i % 200, 'a') + '"';
+    }
+    std::string doc = MakeTaskDocument(20000);
+
+    BenchBytes("skip scalar", blanks, WalkSkip<HJson_skipScalar>);
+#ifdef HJSON_X86_SIMD
+    BenchBytes("skip sse2", blanks, WalkSkip<HJson_skipSSE2>);
+    if (__builtin_cpu_supports("avx2")) {
+        BenchBytes("skip avx2", blanks, WalkSkip<HJson_skipAVX2>);
+    }
+#endif // HJSON_X86_SIMD
+    BenchBytes("string scalar", strings, WalkString<HJson_scanStringScalar>);
+#ifdef HJSON_X86_SIMD
+    BenchBytes("string sse2", strings, WalkString<HJson_scanStringSSE2>);
+    if (__builtin_cpu_supports("avx2")) {
+        BenchBytes("string avx2", strings, WalkString<HJson_scanStringAVX2>);
+    }
+#endif // HJSON_X86_SIMD
+    BenchBytes("parse tasks", doc, ParseDocument);
+    BenchBytes("parse events tasks", doc, ParseEvents);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "task_client.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using BenchClock = std::chrono::steady_clock;
+
+static const int kBenchTasks = 200;
+static const int kBenchOpsPerClient = 5000;
+static const int kBenchSpawnOps = 200;
+
+// Mixed traffic: 60% update, 20% mark-done, 20% list done
+static ServeRequest MakeOp(unsigned* seed) {
+    ServeRequest req;
+    int kind = rand_r(seed) % 10;
+    std::string id = std::to_string(rand_r(seed) % kBenchTasks + 1);
+    if (kind < 6) {
+        req.words = { "update", id, "updated " + std::to_string(rand_r(seed)) };
+    } else if (kind < 8) {
+        req.words = { "mark-done", id };
+    } else {
+        req.words = { "list", "done" };
+    }
+    return req;
+}
+
+// One client on its own connection, returns ops that failed
+static int RunClient(const std::string& socket, int ops, unsigned seed) {
+    int fd = ServeConnect(socket);
+    if (fd < 0) {
+        return ops;
+    }
+    int failed = 0;
+    for (int i = 0; i < ops; ++i) {
+        ServeReply reply;
+        if (!ServeCall(fd, MakeOp(&seed), &reply) || reply.rc != 0) {
+            failed++;
+        }
+    }
+    close(fd);
+    return failed;
+}
+
+// Run clients processes in parallel against the server and report ops/sec
+static void BenchClients(const std::string& socket, int clients) {
+    BenchClock::time_point begin = BenchClock::now();
+    for (int c = 0; c < clients; ++c) {
+        if (fork() == 0) {
+            int failed = RunClient(socket, kBenchOpsPerClient, c + 1);
+            _exit(failed ? 1 : 0);
+        }
+    }
+    int failed = 0;
+    for (int c = 0; c < clients; ++c) {
+        int status = 0;
+        wait(&status);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    std::chrono::duration<double> elapsed = BenchClock::now() - begin;
+    double ops = (double)clients * kBenchOpsPerClient;
+    printf("serve %2d clients %10.0f ops/s%s\n", clients, ops / elapsed.count(),
+           failed ? " (client errors)" : "");
+    fflush(stdout);
+}
+
+// Same traffic with one process per command, the path without a server
+static void BenchSpawn(const std::string& cli) {
+    unsigned seed = 1;
+    BenchClock::time_point begin = BenchClock::now();
+    for (int i = 0; i < kBenchSpawnOps; ++i) {
+        ServeRequest req = MakeOp(&seed);
+        std::string cmd = "TTC_NO_SERVE=1 " + cli;
+        for (size_t w = 0; w < req.words.size(); ++w) {
+            cmd += " '" + req.words[w] + "'";
+        }
+        cmd += " >/dev/null";
+        if (system(cmd.c_str()) != 0) {
+            printf("spawn: command failed\n");
+            return;
+        }
+    }
+    std::chrono::duration<double> elapsed = BenchClock::now() - begin;
+    printf("spawn per command  %10.0f ops/s\n", kBenchSpawnOps / elapsed.count());
+}
+
+int main(int argc, char const *argv[])
+{
+    char cwd[4096];
+    std::string cli = argc > 1 ? argv[1] : "./task_cli.out";
+    if (cli[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+        cli = std::string(cwd) + "/" + cli;
+    }
+    char dir[] = "/tmp/ttc_bench_serve_XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        printf("Failed to create work dir\n");
+        return 1;
+    }
+    std::string seed_cmd = "for i in $(seq " + std::to_string(kBenchTasks) + "); do echo \"add task$i\"; done"
+        " | TTC_NO_SERVE=1 " + cli + " batch >/dev/null 2>&1";
+    if (system(seed_cmd.c_str()) != 0) {
+        printf("Failed to seed tasks\n");
+        return 1;
+    }
+    BenchSpawn(cli);
+    // Children must not repeat what is still buffered
+    fflush(stdout);
+
+    pid_t server = fork();
+    if (server == 0) {
+        freopen("/dev/null", "w", stdout);
+        execl(cli.c_str(), cli.c_str(), "serve", (char*)0);
+        _exit(127);
+    }
+    std::string socket = "task.json.sock";
+    int fd = -1;
+    for (int i = 0; i < 100 && fd < 0; ++i) {
+        usleep(20000);
+        fd = ServeConnect(socket);
+    }
+    if (fd < 0) {
+        printf("Server did not come up\n");
+        return 1;
+    }
+    close(fd);
+    BenchClients(socket, 1);
+    BenchClients(socket, 4);
+    BenchClients(socket, 16);
+    kill(server, SIGTERM);
+    waitpid(server, 0, 0);
+    std::string cleanup = std::string("rm -rf ") + dir;
+    return system(cleanup.c_str()) == 0 ? 0 : 1;
+}
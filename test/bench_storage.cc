@@ -0,0 +1,64 @@
+#include "task_storage.hpp"
+#include "task_time.hpp"
+#include <chrono>
+#include <memory>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using BenchClock = std::chrono::steady_clock;
+
+static const int kBenchRounds = 10;
+static const int kBenchTasks = 200000;
+
+static std::vector<Task> MakeTasks(int count) {
+    std::vector<Task> tasks(count);
+    for (int i = 0; i < count; ++i) {
+        tasks[i].id = i + 1;
+        tasks[i].description = "Task number " + std::to_string(i + 1) + " with a short note";
+        tasks[i].status = i % 3;
+        ParseTaskTime("2024-01-01 00:00:00", &tasks[i].created_at);
+        ParseTaskTime("2024-06-30 12:34:56", &tasks[i].updated_at);
+    }
+    return tasks;
+}
+
+// Save then load tasks kBenchRounds times through storage and report ms/op
+static void BenchStorage(const char* name, TaskStorage* storage, const TaskRefs& refs) {
+    double save = 0, load = 0;
+    size_t bytes = 0, sink = 0;
+    for (int i = 0; i < kBenchRounds; ++i) {
+        BenchClock::time_point begin = BenchClock::now();
+        if (!storage->Save(refs)) {
+            printf("%s: save failed\n", name);
+            return;
+        }
+        BenchClock::time_point middle = BenchClock::now();
+        std::vector<Task> tasks;
+        if (!storage->Load(tasks, &bytes)) {
+            printf("%s: load failed\n", name);
+            return;
+        }
+        BenchClock::time_point end = BenchClock::now();
+        save += std::chrono::duration<double, std::milli>(middle - begin).count();
+        load += std::chrono::duration<double, std::milli>(end - middle).count();
+        sink += tasks.size();
+    }
+    printf("%-8s %10zu bytes  save %8.2f ms  load %8.2f ms (%zu)\n",
+           name, bytes, save / kBenchRounds, load / kBenchRounds, sink);
+    unlink(storage->Path().c_str());
+}
+
+int main(int argc, char const *argv[])
+{
+    std::vector<Task> tasks = MakeTasks(kBenchTasks);
+    TaskRefs refs;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        refs.push_back(&tasks[i]);
+    }
+    std::unique_ptr<TaskStorage> json(CreateStorage(StorageKind::kJson, "bench_storage.json"));
+    std::unique_ptr<TaskStorage> binary(CreateStorage(StorageKind::kBinary, "bench_storage.db"));
+    BenchStorage("json", json.get(), refs);
+    BenchStorage("binary", binary.get(), refs);
+    return 0;
+}
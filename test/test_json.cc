@@ -1,17 +1,39 @@
 #include "hjson.hpp"
+#include "hjson_schema.hpp"
 #include <fstream>
 #include <iostream>
+#include <string>
+
+static bool CollectItem(void* ctx, const char* text, int len) {
+    HJson* item = HJson_parse(text);
+    if (!item) {
+        return false;
+    }
+    HJson_addItem(static_cast<HJson*>(ctx), item);
+    return true;
+}
 
 HJson* TestDeserialize(const char* json_file) {
-    // Reading file
+    // Reading file in chunks, no limit on document size
     std::ifstream in(json_file);
     char f_buf[1024] = {0};
-    in.read(f_buf, 1024);
+    HJson* root_node = HJson_createArray();
+    HJson_stream st;
+    HJson_streamInit(&st, CollectItem, root_node);
+    bool ok = true;
+    while (ok && in) {
+        in.read(f_buf, sizeof(f_buf));
+        ok = HJson_streamFeed(&st, f_buf, in.gcount());
+    }
+    ok = ok && HJson_streamFinish(&st);
+    HJson_streamRelease(&st);
     std::cout
-        << f_buf
+        << "Deserialize "
+        << json_file
+        << ": "
+        << ok
         << std::endl;
-    // Deserialize
-    return HJson_parse(f_buf);
+    return root_node;
 }
 
 void TestSerialize(HJson* node) {
@@ -23,7 +45,7 @@ void TestSerialize(HJson* node) {
         << '\n'
         << ret
         << std::endl;
-    delete ret;
+    free((void*)ret);
 }
 
 void TestCreateArray() {
@@ -38,12 +60,334 @@ void TestCreateArray() {
     HJson_delete(array_node);
 }
 
+void TestAppendChain() {
+    // A detached chain is appended whole, later appends go after its end
+    HJson* array_node = HJson_createArray();
+    HJson* first = HJson_createNumber(1);
+    first->next = HJson_createNumber(2);
+    HJson_addItem(array_node, first);
+    HJson_addItem(array_node, HJson_createNumber(3));
+    HJson* chain = HJson_createNumber(4);
+    chain->next = HJson_createNumber(5);
+    HJson* items[2] = { chain, HJson_createNumber(6) };
+    HJson_addItems(array_node, items, 2);
+    HJson_addItem(array_node, HJson_createNumber(7));
+    TestSerialize(array_node);
+    HJson_delete(array_node);
+}
+
+void TestArena() {
+    HJson_arena arena = {};
+    HJson* root_node = HJson_parse("[{\"id\":\"1\",\"status\":0},{\"id\":\"2\",\"status\":2}]", &arena);
+    // Hand built nodes still go through malloc
+    HJson* object_node = HJson_createObject();
+    HJson_addItemToObject(object_node, "id", HJson_createString("3"));
+    HJson_addItem(root_node, object_node);
+    TestSerialize(root_node);
+    // Frees malloc'ed nodes only, arena owned ones are released at once
+    HJson_delete(root_node);
+    HJson_arenaRelease(&arena);
+}
+
+void TestInSitu() {
+    char text[] = "{\"plain\":\"Buy milk\",\"escaped\":\"Say \\\"hi\\\"\\n\\u00e9\\ud83d\\ude00\"}";
+    HJson* root_node = HJson_parseInSitu(text);
+    HJson* p = root_node->child;
+    // Unescaped string is a view into text
+    std::cout
+        << "In situ: "
+        << (p->sv > text && p->sv < text + sizeof(text))
+        << ' '
+        << p->next->sv
+        << std::endl;
+    TestSerialize(root_node);
+    HJson_delete(root_node);
+}
+
+void TestScanKernels() {
+    // Every offset of a mixed buffer, kernels must agree with scalar loops
+    char text[300] = {0};
+    const char alphabet[] = " \t\n\ra\"\\{";
+    for (int i = 0; i < 299; ++i) {
+        text[i] = alphabet[(i * 7 + i / 13) % (sizeof(alphabet) - 1)];
+    }
+    int mismatch = 0;
+    for (int i = 0; i < 299; ++i) {
+        if (HJson_kernel.skip(text + i) != HJson_skipScalar(text + i)) {
+            mismatch++;
+        }
+        if (HJson_kernel.scan_string(text + i) != HJson_scanStringScalar(text + i)) {
+            mismatch++;
+        }
+    }
+    std::cout
+        << "Scan kernels mismatch: "
+        << mismatch
+        << std::endl;
+}
+
+void TestNumbers() {
+    const char* numbers[] = {
+        "0", "-0", "42", "-2147483649", "9007199254740993", "18446744073709551616",
+        "0.1", "3.14159265358979323846", "1e23", "-2.5e-3", "5e-324", "2.2250738585072011e-308",
+        "1.7976931348623157e308", "123456789012345678901234567890e-10", "1e400"
+    };
+    int mismatch = 0;
+    HJson* array_node = HJson_createArray();
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i) {
+        HJson item = {};
+        HJson_parseNumber(&item, numbers[i]);
+        double expected = strtod(numbers[i], 0);
+        if (memcmp(&expected, &item.dv, sizeof(double)) != 0) {
+            mismatch++;
+        }
+        HJson_addItem(array_node, HJson_createNumber(item.dv));
+    }
+    std::cout
+        << "Numbers mismatch: "
+        << mismatch
+        << std::endl;
+    TestSerialize(array_node);
+    HJson_delete(array_node);
+
+    // Written with the fewest digits that read back, subnormals included
+    const char* shortest[] = {
+        "0.1", "1e+23", "-0.0025", "5e-324", "1e-310", "2.2250738585072014e-308", "0.30000000000000004"
+    };
+    mismatch = 0;
+    for (size_t i = 0; i < sizeof(shortest) / sizeof(shortest[0]); ++i) {
+        HJson* number_node = HJson_createNumber(strtod(shortest[i], 0));
+        int out_len = 0;
+        const char* ret = HJson_write(number_node, out_len);
+        if (strcmp(ret, shortest[i]) != 0) {
+            std::cout << "Shortest: " << ret << " for " << shortest[i] << std::endl;
+            mismatch++;
+        }
+        free((void*)ret);
+        HJson_delete(number_node);
+    }
+    std::cout
+        << "Shortest mismatch: "
+        << mismatch
+        << std::endl;
+}
+
+void TestWriteTo() {
+    // Descriptions longer than the stream buffer go out through writev
+    HJson* array_node = HJson_createArray();
+    std::string description(HJSON_STREAM_BUFFER_SIZE, 'd');
+    for (int i = 0; i < 4; ++i) {
+        HJson* object_node = HJson_createObject();
+        HJson_addItemToObject(object_node, "description", HJson_createString(description.c_str()));
+        HJson_addItemToObject(object_node, "status", HJson_createNumber(i));
+        HJson_addItem(array_node, object_node);
+    }
+    FILE* tmp = tmpfile();
+    bool ok = HJson_writeTo(array_node, fileno(tmp));
+    int out_len = 0;
+    const char* ret = HJson_write(array_node, out_len);
+    std::string streamed(out_len + 1, '\0');
+    rewind(tmp);
+    size_t n = fread(&streamed[0], 1, streamed.size(), tmp);
+    std::cout
+        << "Write to fd: "
+        << ok
+        << ' '
+        << (n == (size_t)out_len && !memcmp(streamed.data(), ret, out_len))
+        << std::endl;
+    free((void*)ret);
+    fclose(tmp);
+    HJson_delete(array_node);
+}
+
+static bool CountEvent(void* ctx) {
+    (*static_cast<int*>(ctx))++;
+    return true;
+}
+
+static bool CountString(void* ctx, const char* str, int len) {
+    std::cout.write(str, len) << ' ';
+    return CountEvent(ctx);
+}
+
+static bool CountNumber(void* ctx, double dv, int biv) {
+    std::cout << dv << ' ';
+    return CountEvent(ctx);
+}
+
+void TestEvents() {
+    HJson_handler handler = {
+        CountEvent, CountEvent, CountEvent, CountEvent,
+        CountString, CountString, CountNumber, 0, CountEvent
+    };
+    int events = 0;
+    bool ok = HJson_parseEvents("[{\"id\":\"1\",\"status\":2,\"tags\":[\"a\\tb\",null]}]", &handler, &events);
+    std::cout
+        << "\nEvents: "
+        << ok
+        << ' '
+        << events
+        << std::endl;
+}
+
+void TestStream() {
+    // Same document fed in every chunk size must give the same elements
+    const char* text = " [ {\"id\":\"1\",\"d\":\"a,]\\\"}\"} , [1,[2]] ,\"x\", 3.5,null ] ";
+    int len = strlen(text);
+    int mismatch = 0;
+    std::string expected;
+    for (int chunk = 1; chunk <= len; ++chunk) {
+        HJson* root_node = HJson_createArray();
+        HJson_stream st;
+        HJson_streamInit(&st, CollectItem, root_node);
+        bool ok = true;
+        for (int i = 0; ok && i < len; i += chunk) {
+            ok = HJson_streamFeed(&st, text + i, chunk < len - i ? chunk : len - i);
+        }
+        ok = ok && HJson_streamFinish(&st);
+        HJson_streamRelease(&st);
+        int out_len = 0;
+        const char* ret = HJson_write(root_node, out_len);
+        if (chunk == 1) {
+            expected = ret;
+        }
+        if (!ok || expected != ret) {
+            mismatch++;
+        }
+        free((void*)ret);
+        HJson_delete(root_node);
+    }
+    HJson* root_node = HJson_createArray();
+    HJson_stream st;
+    HJson_streamInit(&st, CollectItem, root_node);
+    bool trailing_comma = HJson_streamFeed(&st, "[1,]", 4) && HJson_streamFinish(&st);
+    HJson_streamRelease(&st);
+    HJson_delete(root_node);
+    std::cout
+        << "Stream: "
+        << expected
+        << " mismatch: "
+        << mismatch
+        << " trailing comma: "
+        << trailing_comma
+        << std::endl;
+}
+
+void TestObjectItem() {
+    HJson_arena arena = {};
+    HJson* root_node = HJson_parse("[{\"id\":\"1\",\"status\":1},{\"status\":2,\"id\":\"2\",\"k\\u0065y\":3}]", &arena);
+    HJson* first = root_node->child;
+    HJson* second = first->next;
+    // Repeated keys share one interned copy
+    bool shared = HJson_getObjectItem(first, "id")->key == HJson_getObjectItem(second, "id")->key;
+    std::cout
+        << "Object item: "
+        << shared
+        << ' '
+        << HJson_getObjectItem(second, "id")->sv
+        << ' '
+        << HJson_getObjectItem(second, "status")->biv
+        << ' '
+        << HJson_getObjectItem(second, "key")->biv
+        << ' '
+        << (HJson_getObjectItem(first, "missing") == 0)
+        << std::endl;
+    HJson_arenaRelease(&arena);
+}
+
+struct Sample {
+    std::string name;
+    int count;
+};
+
+template <>
+struct HJsonSchema<Sample> {
+    HJSON_FIELD(Sample, name);
+    HJSON_FIELD(Sample, count);
+    typedef HJsonFields<name_field, count_field> fields;
+};
+
+void TestSchema() {
+    std::vector<Sample> samples;
+    bool ok = HJson_readRecords("[{\"count\":2,\"name\":\"a\\\"b\",\"extra\":{\"name\":\"x\"}},{\"name\":\"c\"}]", samples);
+    HJson_buffer buf = {};
+    HJson_putc(&buf, '[');
+    for (size_t i = 0; i < samples.size(); ++i) {
+        if (i) {
+            HJson_putc(&buf, ',');
+        }
+        HJson_writeRecord(&buf, samples[i]);
+    }
+    HJson_putc(&buf, ']');
+    std::cout
+        << "Schema: "
+        << ok
+        << ' ';
+    std::cout.write(buf.buffer, buf.offset) << std::endl;
+    free(buf.buffer);
+}
+
+// A schema member its codec cannot take fails the read instead of being
+// left at its default
+void TestSchemaMismatch() {
+    const char* texts[] = {
+        "[{\"name\":\"a\",\"count\":\"2\"}]",
+        "[{\"name\":1}]",
+        "[{\"count\":null}]",
+        "[{\"count\":1.7}]",
+        "[{\"count\":1e12}]",
+        "[{\"count\":-3e9}]",
+        "[{\"name\":true}]",
+        "[{\"count\":{\"n\":2}}]",
+        "[{\"name\":[\"a\"]}]",
+    };
+    int accepted = 0;
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+        std::vector<Sample> samples;
+        accepted += HJson_readRecords(texts[i], samples);
+    }
+    std::cout
+        << "Schema mismatch accepted: "
+        << accepted
+        << std::endl;
+}
+
+static bool KeepCounted(void* /*ctx*/, const Sample& s) {
+    return s.count > 1;
+}
+
+// Names of rejected records are never decoded into them
+void TestKeepRecords() {
+    std::vector<Sample> samples;
+    bool ok = HJson_readRecords<Sample>("[{\"name\":\"a\",\"count\":2},{\"name\":\"b\",\"count\":1},{\"name\":\"c\",\"count\":3},{\"count\":4}]",
+                                        HJson_collectRecord<Sample>, &samples, KeepCounted, "name");
+    std::cout
+        << "Keep: "
+        << ok;
+    for (size_t i = 0; i < samples.size(); ++i) {
+        std::cout << ' ' << samples[i].name << samples[i].count;
+    }
+    std::cout << std::endl;
+}
+
 int main(int argc, char const *argv[])
 {
     HJson* root_node = 0;
     root_node = TestDeserialize("task.json");
     TestSerialize(root_node);
     TestCreateArray();
+    TestAppendChain();
+    TestArena();
+    TestInSitu();
+    TestScanKernels();
+    TestNumbers();
+    TestWriteTo();
+    TestEvents();
+    TestStream();
+    TestObjectItem();
+    TestSchema();
+    TestSchemaMismatch();
+    TestKeepRecords();
     HJson_delete(root_node);
     return 0;
 }
@@ -0,0 +1,101 @@
+#include "task_client.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    printf("%s: %d\n", what, ok);
+    if (!ok) {
+        failures++;
+    }
+}
+
+static ServeReply Call(int fd, const std::vector<std::string>& words) {
+    ServeRequest req;
+    req.words = words;
+    ServeReply reply = { -1, "", "" };
+    if (!ServeCall(fd, req, &reply)) {
+        reply.rc = -1;
+    }
+    return reply;
+}
+
+// A request that hits a broken store fails alone, the server stays up and
+// answers again once the store is readable
+int main(int argc, char const *argv[])
+{
+    char cwd[4096];
+    std::string cli = argc > 1 ? argv[1] : "./task_cli.out";
+    if (cli[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+        cli = std::string(cwd) + "/" + cli;
+    }
+    char dir[] = "/tmp/ttc_test_serve_XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        printf("Failed to create work dir\n");
+        return 1;
+    }
+    fflush(stdout);
+    pid_t server = fork();
+    if (server == 0) {
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        execl(cli.c_str(), cli.c_str(), "serve", (char*)0);
+        _exit(127);
+    }
+    int fd = -1;
+    for (int i = 0; i < 100 && fd < 0; ++i) {
+        usleep(20000);
+        fd = ServeConnect("task.json.sock");
+    }
+    if (fd < 0) {
+        printf("Server did not come up\n");
+        return 1;
+    }
+    Check(Call(fd, { "add", "first" }).rc == 0, "Add");
+
+    // Another process leaves a snapshot the server cannot parse
+    { std::ofstream("task.json") << "[{\"id\":"; }
+    ServeReply broken = Call(fd, { "list" });
+    Check(broken.rc == 1 && broken.err.find("Failed to load") != std::string::npos, "Broken store fails the request");
+    Check(Call(fd, { "add", "second" }).rc == 1, "Broken store fails a change");
+    Check(kill(server, 0) == 0, "Server still running");
+
+    // Times older versions wrote that do not parse keep the task loadable,
+    // and years before 1970 read as themselves
+    { std::ofstream("task.json")
+        << "[{\"id\":\"7\",\"description\":\"a\",\"status\":0,"
+           "\"created_at\":\"2024-1-5 10:00:00\",\"updated_at\":\"2024-02-30 10:00:00\"},"
+           "{\"id\":\"8\",\"description\":\"b\",\"status\":0,"
+           "\"created_at\":\"1969-07-20 20:17:40\",\"updated_at\":\"1969-07-21 02:56:15\"}]"; }
+    ServeReply legacy = Call(fd, { "list", "--format=csv" });
+    Check(legacy.rc == 0
+          && legacy.out.find("7,a,0,0000-01-01 00:00:00,0000-01-01 00:00:00") != std::string::npos
+          && legacy.out.find("8,b,0,1969-07-20 20:17:40,1969-07-21 02:56:15") != std::string::npos,
+          "Legacy times load");
+    Check(legacy.err.find("2 times in task.json do not parse") != std::string::npos, "Legacy times warned");
+    ServeReply early = Call(fd, { "list", "--created-before=1970-01-01", "--format=csv" });
+    Check(early.rc == 0 && early.out.find("7,a") != std::string::npos && early.out.find("8,b") != std::string::npos,
+          "Legacy times filter");
+
+    unlink("task.json");
+    ServeReply listed = Call(fd, { "list", "--format=csv" });
+    Check(listed.rc == 0 && listed.out.find("first") != std::string::npos, "Served again once readable");
+    Check(Call(fd, { "add", "third" }).rc == 0, "Changes again once readable");
+    close(fd);
+
+    kill(server, SIGTERM);
+    int status = 0;
+    waitpid(server, &status, 0);
+    Check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Clean shutdown");
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) {
+        failures++;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,550 @@
+#include "byte_codec.hpp"
+#include "task_handler.hpp"
+#include "task_log.hpp"
+#include "task_storage.hpp"
+#include "task_time.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+// task_cli.out for the tests that need a second process
+static std::string cli;
+
+static void Check(bool ok, const char* what) {
+    printf("%s: %d\n", what, ok);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// Run each test in a fresh directory below the work dir, the store files
+// have fixed names
+static void EnterDir(const std::string& root, const char* name) {
+    std::string dir = root + "/" + name;
+    if (mkdir(dir.c_str(), 0755) != 0 || chdir(dir.c_str()) != 0) {
+        printf("Failed to enter %s\n", dir.c_str());
+        exit(1);
+    }
+}
+
+static off_t FileSize(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+static Task MakeTask(TaskId id, const char* description, int status) {
+    Task t{};
+    t.id = id;
+    t.description = description;
+    t.status = status;
+    ParseTaskTime("2024-01-05 10:00:00", &t.created_at);
+    ParseTaskTime("2024-01-06 11:30:00", &t.updated_at);
+    return t;
+}
+
+// Committed records replay in order, a torn tail is dropped and cut off
+// so the next append lands right behind the last intact record
+void TestLogReplay() {
+    CommitPolicy policy = { 0 };
+    {
+        TaskLog log("task.json.log", policy);
+        log.Append(LogOp::kAdd, MakeTask(1, "first", 0));
+        log.Append(LogOp::kAdd, MakeTask(2, "second", 0));
+        log.Append(LogOp::kUpdate, MakeTask(1, "first, changed", 0));
+        log.Append(LogOp::kMark, MakeTask(2, "", 2));
+        log.Append(LogOp::kDelete, MakeTask(1, "", 0));
+        Check(log.Commit() && log.Sync(), "Log commit");
+    }
+    off_t intact = FileSize("task.json.log");
+    std::vector<LogRecord> records;
+    {
+        TaskLog log("task.json.log", policy);
+        Check(log.Replay(records) && records.size() == 5, "Log replay");
+    }
+    Check(records.size() == 5
+          && records[0].op == LogOp::kAdd && records[0].task.id == 1 && records[0].task.description == "first"
+          && records[0].task.created_at == MakeTask(0, "", 0).created_at
+          && records[2].op == LogOp::kUpdate && records[2].task.description == "first, changed"
+          && records[3].op == LogOp::kMark && records[3].task.id == 2 && records[3].task.status == 2
+          && records[4].op == LogOp::kDelete && records[4].task.id == 1,
+          "Log records");
+
+    // A crash in the middle of an append leaves half a frame
+    { std::ofstream("task.json.log", std::ios::app) << std::string("\x20\0\0\0\x01\x02", 6) << "par"; }
+    records.clear();
+    {
+        TaskLog log("task.json.log", policy);
+        Check(log.Replay(records) && records.size() == 5, "Torn tail dropped");
+        Check(FileSize("task.json.log") == intact, "Torn tail cut off");
+        log.Append(LogOp::kAdd, MakeTask(3, "third", 0));
+        Check(log.Commit() && log.Sync(), "Append after torn tail");
+    }
+    records.clear();
+    {
+        TaskLog log("task.json.log", policy);
+        Check(log.Replay(records) && records.size() == 6 && records[5].task.description == "third",
+              "Replay after torn tail");
+    }
+
+    // A frame whose bytes do not match its crc ends the log as well
+    {
+        std::fstream f("task.json.log", std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(intact + 12);
+        f.put('X');
+    }
+    records.clear();
+    {
+        TaskLog log("task.json.log", policy);
+        Check(log.Replay(records) && records.size() == 5 && FileSize("task.json.log") == intact,
+              "Corrupt frame dropped");
+    }
+    Check(unlink("task.json.log") == 0, "Log removed");
+    records.clear();
+    {
+        TaskLog log("task.json.log", policy);
+        Check(log.Replay(records) && records.empty(), "Missing log is empty");
+    }
+}
+
+static bool SameTask(const Task& a, const Task& b) {
+    return a.id == b.id && a.description == b.description && a.status == b.status
+        && a.created_at == b.created_at && a.updated_at == b.updated_at;
+}
+
+static TaskRefs RefsOf(const std::vector<Task>& tasks) {
+    TaskRefs refs;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        refs.push_back(&tasks[i]);
+    }
+    return refs;
+}
+
+// Every field survives a save and load, and snapshots of older versions
+// with heap-text ids and times still load
+void TestBinaryRoundTrip() {
+    std::vector<Task> tasks;
+    tasks.push_back(MakeTask(1, "plain", 0));
+    tasks.push_back(MakeTask(300, "quote \" comma , newline \n \xc3\xa9", 2));
+    tasks.push_back(MakeTask(kMaxTaskId, "", 1));
+    ParseTaskTime("1969-07-20 20:17:40", &tasks[2].created_at);
+    tasks[2].updated_at = kMaxTaskTime;
+    std::unique_ptr<TaskStorage> db(CreateStorage(StorageKind::kBinary, "task.db"));
+    std::vector<Task> loaded;
+    size_t bytes = 0;
+    Check(db->Save(RefsOf(tasks)), "Binary save");
+    Check(db->Load(loaded, &bytes) && bytes == (size_t)FileSize("task.db"), "Binary load");
+    bool same = loaded.size() == tasks.size();
+    for (size_t i = 0; same && i < tasks.size(); ++i) {
+        same = SameTask(loaded[i], tasks[i]);
+    }
+    Check(same, "Binary round trip");
+
+    loaded.clear();
+    TaskKeep keep = [](const Task& t) { return t.status == 2; };
+    Check(db->Load(loaded, &bytes, keep) && loaded.size() == 1 && SameTask(loaded[0], tasks[1]),
+          "Binary keep");
+
+    // Every byte counts, a flipped one fails the crc
+    {
+        std::fstream f("task.db", std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(FileSize("task.db") - 3);
+        f.put('X');
+    }
+    loaded.clear();
+    Check(!db->Load(loaded, &bytes), "Binary corrupt rejected");
+
+    // Written by an older version: id and both times as heap text, one time
+    // never parsed
+    std::string heap, records;
+    PutBytes(heap, "legacy");
+    PutBytes(heap, "7");
+    PutBytes(heap, "2024-1-5 10:00:00");
+    PutBytes(heap, "2024-01-06 11:30:00");
+    PutVarint(records, 7);
+    PutVarint(records, 1);
+    records.push_back(0x07);
+    PutVarint(records, 9);
+    PutVarint(records, 27);
+    PutVarint(records, 0);
+    std::string header("TTCB", 4);
+    PutFixed32(header, 1);
+    PutFixed32(header, 1);
+    PutFixed32(header, Crc32Update(Crc32(records.data(), records.size()), heap.data(), heap.size()));
+    PutFixed64(header, records.size());
+    PutFixed64(header, heap.size());
+    { std::ofstream("task.db", std::ios::binary) << header << records << heap; }
+    loaded.clear();
+    size_t unknown = UnknownTaskTimes();
+    Check(db->Load(loaded, &bytes) && loaded.size() == 1 && loaded[0].id == 7
+          && loaded[0].description == "legacy" && loaded[0].created_at == kUnknownTaskTime
+          && loaded[0].updated_at == MakeTask(0, "", 0).updated_at
+          && UnknownTaskTimes() == unknown + 1,
+          "Binary legacy heap text");
+}
+
+// Output and exit code of one command run the way a CLI process runs it
+struct CmdResult {
+    int rc;
+    std::string out;
+    std::string err;
+};
+
+template <typename Fn>
+static CmdResult Capture(TaskHandler& th, Fn fn) {
+    CmdResult r = { 1, "", "" };
+    char* out = 0;
+    char* err = 0;
+    size_t out_len = 0, err_len = 0;
+    FILE* out_f = open_memstream(&out, &out_len);
+    FILE* err_f = open_memstream(&err, &err_len);
+    th.SetOutput(out_f, err_f);
+    ErrLast().clear();
+    r.rc = fn();
+    if (!th.Unlock()) {
+        r.rc = 1;
+    }
+    th.SetOutput(stdout, stderr);
+    fclose(out_f);
+    fclose(err_f);
+    r.out.assign(out, out_len);
+    r.err.assign(err, err_len);
+    r.err += ErrLast();
+    free(out);
+    free(err);
+    return r;
+}
+
+static CmdResult Run(TaskHandler& th, const std::vector<std::string>& words) {
+    std::vector<std::string> args(words.begin() + 1, words.end());
+    return Capture(th, [&th, &words, &args]() { return th.Handle(words[0], args); });
+}
+
+static CmdResult Run(const std::vector<std::string>& words) {
+    TaskHandler th;
+    return Run(th, words);
+}
+
+// First column of csv rows, the ids, joined by spaces
+static std::string Ids(const std::string& csv) {
+    std::string ids;
+    size_t line = csv.find('\n');
+    while (line != std::string::npos && line + 1 < csv.size()) {
+        size_t comma = csv.find(',', line + 1);
+        ids += (ids.empty() ? "" : " ") + csv.substr(line + 1, comma - line - 1);
+        line = csv.find('\n', comma);
+    }
+    return ids;
+}
+
+static std::string ListIds(const std::vector<std::string>& words) {
+    std::vector<std::string> list = words;
+    list.insert(list.begin(), "list");
+    list.push_back("--format=csv");
+    CmdResult r = Run(list);
+    return r.rc == 0 ? Ids(r.out) : "rc=" + std::to_string(r.rc);
+}
+
+static bool Compact() {
+    TaskHandler th;
+    return th.Compact();
+}
+
+// Point loads read single records through the .idx sidecar, saves copy
+// records not marked dirty straight from the old snapshot
+void TestJsonIndex() {
+    std::vector<Task> tasks;
+    tasks.push_back(MakeTask(1, "one", 0));
+    tasks.push_back(MakeTask(2, "two", 1));
+    tasks.push_back(MakeTask(3, "three", 2));
+    std::unique_ptr<TaskStorage> json(CreateStorage(StorageKind::kJson, "task.json"));
+    size_t bytes = 0;
+    Check(json->Save(RefsOf(tasks)) && FileSize("task.json.idx") == 40 + 3 * 16, "Index written");
+    std::vector<Task> some;
+    Check(json->LoadSome({ 3, 9, 2 }, some, &bytes) && some.size() == 2
+          && SameTask(some[0], tasks[2]) && SameTask(some[1], tasks[1]),
+          "Index point load");
+
+    // Task 1 differs in memory but is clean, its old bytes are kept
+    tasks[0].description = "one, not saved";
+    tasks[1].description = "two, saved";
+    IdSet dirty;
+    dirty.Set(2);
+    std::vector<Task> loaded;
+    Check(json->Save(RefsOf(tasks), &dirty) && json->Load(loaded, &bytes) && loaded.size() == 3
+          && loaded[0].description == "one" && loaded[1].description == "two, saved"
+          && SameTask(loaded[2], tasks[2]),
+          "Clean records spliced");
+    some.clear();
+    Check(json->LoadSome({ 2 }, some, &bytes) && some.size() == 1 && some[0].description == "two, saved",
+          "Index follows splice");
+
+    // Without an index every record is written from memory
+    unlink("task.json.idx");
+    loaded.clear();
+    Check(json->Save(RefsOf(tasks), &dirty) && json->Load(loaded, &bytes)
+          && loaded[0].description == "one, not saved",
+          "No index, no splice");
+
+    // A hand edit changes size and mtime, the index no longer applies
+    { std::ofstream("task.json", std::ios::app) << "\n"; }
+    some.clear();
+    Check(!json->LoadSome({ 2 }, some, &bytes) && some.empty(), "Stale index ignored");
+    Check(Run({ "update", "2", "edited" }).rc == 0 && Run({ "mark-done", "3" }).rc == 0, "Point commands");
+    CmdResult listed = Run({ "list", "--format=csv" });
+    Check(listed.out.find("2,edited,1") != std::string::npos && listed.out.find("3,three,2") != std::string::npos
+          && listed.out.find("1,\"one, not saved\"") != std::string::npos,
+          "Point commands applied");
+}
+
+// Failing lines are reported with their number and skipped, the rest of
+// the batch still runs and is committed
+void TestBatch() {
+    Run({ "add", "existing" });
+    std::istringstream in(
+        "add \"quoted words\"\n"
+        "# a comment\n"
+        "\n"
+        "update 99 missing\n"
+        "frobnicate 1\n"
+        "add \"unterminated\n"
+        "batch nested.txt\n"
+        "update\n"
+        "mark-done 1\n"
+        "delete 2\n"
+        "add last\n");
+    TaskHandler th;
+    CmdResult r = Capture(th, [&th, &in]() { return th.Batch(in); });
+    Check(r.rc == 1, "Batch fails if a line fails");
+    Check(r.err.find("line 4: ") != std::string::npos && r.err.find("line 5: ") != std::string::npos
+          && r.err.find("line 6: Unterminated quote.") != std::string::npos
+          && r.err.find("line 7: ") != std::string::npos && r.err.find("line 8: ") != std::string::npos
+          && r.err.find("line 2:") == std::string::npos && r.err.find("line 9:") == std::string::npos,
+          "Batch reports failing lines");
+    Check(r.err.find("batch: 4 ok, 5 failed") != std::string::npos, "Batch summary");
+    CmdResult listed = Run({ "list", "--format=csv" });
+    Check(Ids(listed.out) == "1 3" && listed.out.find("1,existing,2") != std::string::npos
+          && listed.out.find("3,last,0") != std::string::npos,
+          "Batch changes committed");
+
+    std::istringstream clean("add one\nadd two\n");
+    TaskHandler again;
+    r = Capture(again, [&again, &clean]() { return again.Batch(clean); });
+    Check(r.rc == 0 && r.err == "batch: 2 ok, 0 failed\n" && ListIds({}) == "1 3 4 5", "Batch all ok");
+}
+
+// Start the CLI on words in the current directory, without a server
+static pid_t Spawn(const std::vector<std::string>& words) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(cli.c_str()));
+        for (size_t i = 0; i < words.size(); ++i) {
+            argv.push_back(const_cast<char*>(words[i].c_str()));
+        }
+        argv.push_back(0);
+        freopen("/dev/null", "w", stdout);
+        freopen("/dev/null", "w", stderr);
+        setenv("TTC_NO_SERVE", "1", 1);
+        execv(cli.c_str(), &argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+static bool Exited0(pid_t pid) {
+    int status = 0;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Tasks loaded under the shared lock are checked against the store once
+// the exclusive lock is held, nothing another process wrote meanwhile is
+// overwritten
+void TestLockUpgrade() {
+    TaskHandler a;
+    Check(Run(a, { "list" }).rc == 0, "Loaded, store empty");
+    Check(Run({ "add", "from b" }).rc == 0, "Other handler adds");
+    Check(Run(a, { "add", "from a" }).rc == 0, "Stale table reloaded");
+    CmdResult listed = Run(a, { "list", "--format=csv" });
+    Check(Ids(listed.out) == "1 2" && listed.out.find("1,from b") != std::string::npos
+          && listed.out.find("2,from a") != std::string::npos,
+          "Both adds kept");
+
+    // a holds the shared lock with tasks loaded. The child loads beside
+    // it and waits for the exclusive lock, the upgrade of a races it.
+    Check(a.Load(), "Shared lock held");
+    pid_t child = Spawn({ "add", "from child" });
+    usleep(200000);
+    Check(Run(a, { "add", "after upgrade" }).rc == 0, "Upgrade");
+    Check(Exited0(child), "Child add");
+    listed = Run({ "list", "--format=csv" });
+    Check(Ids(listed.out) == "1 2 3 4" && listed.out.find("from child") != std::string::npos
+          && listed.out.find("after upgrade") != std::string::npos,
+          "Upgrade lost nothing");
+
+    // Many processes adding at once each get their own id
+    std::vector<pid_t> pids;
+    for (int i = 0; i < 8; ++i) {
+        pids.push_back(Spawn({ "batch", "adds.txt" }));
+    }
+    bool ok = true;
+    for (size_t i = 0; i < pids.size(); ++i) {
+        ok = Exited0(pids[i]) && ok;
+    }
+    std::string ids = ListIds({});
+    std::string expect = "1 2 3 4";
+    for (int id = 5; id <= 4 + 8 * 5; ++id) {
+        expect += " " + std::to_string(id);
+    }
+    Check(ok && ids == expect, "Concurrent adds");
+}
+
+static std::string SearchIds(const std::vector<std::string>& words) {
+    std::vector<std::string> search = words;
+    search.insert(search.begin(), "search");
+    search.push_back("--format=csv");
+    CmdResult r = Run(search);
+    return r.rc == 0 ? Ids(r.out) : "rc=" + std::to_string(r.rc);
+}
+
+// Words of a group must all match, OR joins groups. The saved .terms
+// sidecar answers for the snapshot and changes since are merged in.
+void TestSearch() {
+    const char* descriptions[] = { "Buy milk", "buy bread", "milk the cow", "Bread and butter", "unrelated" };
+    for (int i = 0; i < 5; ++i) {
+        Run({ "add", descriptions[i] });
+    }
+    Check(Compact(), "Snapshot for search");
+    Check(SearchIds({ "buy", "milk" }) == "1", "Search AND");
+    struct stat saved, reused;
+    Check(stat("task.json.terms", &saved) == 0 && saved.st_size > 0, "Terms saved");
+    Check(SearchIds({ "milk", "OR", "bread" }) == "1 2 3 4", "Search OR");
+    Check(SearchIds({ "BUY" }) == "1 2", "Search ignores case");
+    Check(SearchIds({ "buy", "cow", "OR", "butter" }) == "4", "Search AND within OR");
+    Check(SearchIds({ "nothing" }) == "", "Search no match");
+    Check(stat("task.json.terms", &reused) == 0 && reused.st_ino == saved.st_ino
+          && reused.st_mtim.tv_nsec == saved.st_mtim.tv_nsec,
+          "Terms reused");
+
+    // Changes since the snapshot are only in the log
+    Run({ "add", "more milk" });
+    Run({ "delete", "1" });
+    Run({ "update", "5", "now with bread" });
+    Check(SearchIds({ "milk" }) == "3 6", "Search sees logged changes");
+    Check(SearchIds({ "bread" }) == "2 4 5", "Search sees logged update");
+
+    // A rewritten snapshot refreshes the sidecar
+    Check(Compact(), "Compact after changes");
+    Check(SearchIds({ "milk", "OR", "bread" }) == "2 3 4 5 6", "Search after compact");
+    Check(Run({ "search", "OR" }).rc == 1, "Search empty group fails");
+}
+
+// Bounds are pushed into the load, sort keys break ties by id and the
+// offset + limit window comes out of a bounded heap
+void TestListQuery() {
+    const char* rows[][5] = {
+        { "1", "delta", "0", "2024-01-01 08:00:00", "2024-03-01 00:00:00" },
+        { "2", "alpha", "1", "2024-02-01 00:00:00", "2024-02-15 00:00:00" },
+        { "3", "charlie", "2", "2023-12-31 23:59:59", "2024-01-10 00:00:00" },
+        { "4", "bravo", "0", "2024-01-15 00:00:00", "2024-01-15 00:00:00" },
+        { "5", "echo", "0", "2024-01-01 00:00:00", "2024-05-01 00:00:00" },
+        { "6", "foxtrot", "1", "2024-03-01 00:00:00", "2024-03-02 00:00:00" },
+    };
+    {
+        std::ofstream json("task.json");
+        for (int i = 0; i < 6; ++i) {
+            json << (i ? "," : "[") << "{\"id\":\"" << rows[i][0] << "\",\"description\":\"" << rows[i][1]
+                 << "\",\"status\":" << rows[i][2] << ",\"created_at\":\"" << rows[i][3]
+                 << "\",\"updated_at\":\"" << rows[i][4] << "\"}";
+        }
+        json << "]";
+    }
+    Check(ListIds({}) == "1 2 3 4 5 6", "List all");
+    Check(ListIds({ "todo" }) == "1 4 5", "List status");
+    Check(ListIds({ "--min-id", "2", "--max-id=4" }) == "2 3 4", "List id range");
+    Check(ListIds({ "--created-after", "2024-01-01", "--created-before", "2024-02-01" }) == "1 4 5",
+          "List created range");
+    Check(ListIds({ "--created-after=2024-01-01 08:00:00" }) == "1 2 4 6", "List bound inclusive");
+    Check(ListIds({ "--updated-before=2024-02" }) == "rc=1" && ListIds({ "--created-after=2024-13-01" }) == "rc=1",
+          "List bad bound");
+    Check(ListIds({ "in-progress", "--updated-after=2024-03-01" }) == "6", "List status and bound");
+
+    Check(ListIds({ "--sort=description" }) == "2 4 3 1 5 6", "Sort description");
+    Check(ListIds({ "--sort=-created" }) == "6 2 4 1 5 3", "Sort descending");
+    Check(ListIds({ "--sort=status" }) == "1 4 5 2 6 3", "Sort ties by id");
+    Check(ListIds({ "--sort=bogus" }) == "rc=1", "Sort unknown key");
+    Check(ListIds({ "--sort=created", "--limit=2" }) == "3 5", "Top K");
+    Check(ListIds({ "--sort=created", "--offset=2", "--limit=3" }) == "1 4 2", "Top K with offset");
+    Check(ListIds({ "--sort=-updated", "--offset=5", "--limit=10" }) == "3", "Offset near the end");
+    Check(ListIds({ "--offset=6" }) == "" && ListIds({ "--limit=0" }) == "", "Empty window");
+    Check(ListIds({ "todo", "--sort=-description", "--created-before=2024-02-01", "--limit=2" }) == "5 1",
+          "Filter, sort and window");
+
+    // Tasks the log changed are loaded whatever the snapshot says
+    Run({ "mark-done", "4" });
+    Run({ "update", "6", "aardvark" });
+    Check(ListIds({ "done", "--max-id=5" }) == "3 4", "Filter sees logged mark");
+    Check(ListIds({ "--sort=description", "--min-id=2", "--limit=1" }) == "6", "Sort sees logged update");
+}
+
+// A deleted id is never handed out again, not even the highest one once
+// compaction dropped the log that deleted it
+void TestRetiredIds() {
+    for (int i = 0; i < 4; ++i) {
+        Run({ "add", "task" });
+    }
+    Check(Run({ "delete", "4" }).rc == 0 && Run({ "delete", "3" }).rc == 0, "Delete highest");
+    Check(Compact(), "Compact");
+    Check(Run({ "add", "after compact" }).rc == 0 && ListIds({}) == "1 2 5", "Highest id retired");
+    Check(Run({ "delete", "5" }).rc == 0 && Compact() && Compact(), "Compact twice");
+    Check(Run({ "add", "again" }).rc == 0 && ListIds({}) == "1 2 6", "Retired across compactions");
+    Check(Run({ "delete", "1" }).rc == 0 && Run({ "add", "low gap" }).rc == 0 && ListIds({}) == "2 6 7",
+          "Low ids retired");
+}
+
+int main(int argc, char const *argv[])
+{
+    char cwd[4096];
+    cli = argc > 1 ? argv[1] : "./task_cli.out";
+    if (cli[0] != '/' && getcwd(cwd, sizeof(cwd))) {
+        cli = std::string(cwd) + "/" + cli;
+    }
+    char dir[] = "/tmp/ttc_test_store_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("Failed to create work dir\n");
+        return 1;
+    }
+    EnterDir(dir, "log");
+    TestLogReplay();
+    EnterDir(dir, "binary");
+    TestBinaryRoundTrip();
+    EnterDir(dir, "index");
+    TestJsonIndex();
+    EnterDir(dir, "batch");
+    TestBatch();
+    EnterDir(dir, "lock");
+    { std::ofstream("adds.txt") << "add a\nadd b\nadd c\nadd d\nadd e\n"; }
+    TestLockUpgrade();
+    EnterDir(dir, "search");
+    TestSearch();
+    EnterDir(dir, "list");
+    TestListQuery();
+    EnterDir(dir, "retired");
+    TestRetiredIds();
+    if (chdir("/") != 0) {
+        failures++;
+    }
+    std::string cleanup = std::string("rm -rf ") + dir;
+    if (system(cleanup.c_str()) != 0) {
+        failures++;
+    }
+    return failures ? 1 : 0;
+}